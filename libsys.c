@@ -1,5 +1,6 @@
 #include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <assert.h>
 #include <limits.h>
 #include <malloc.h>
@@ -9,7 +10,27 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <io.h>
+#ifndef _WIN32
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+#ifdef LIBSYS_IO_URING
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
 
 typedef struct tlistnode_s {
 	struct tlistnode_s *prev, *next;
@@ -22,6 +43,125 @@ typedef struct tlist_s {
 } TList;
 
 typedef bool(TLMatchFn)(void *data, void *args);
+typedef void(TLVisitFn)(void *data, void *args);
+
+typedef struct hashentry_s {
+	uint32_t key;
+	void *ref;
+} HashEntry;
+
+typedef struct hashindex_s {
+	size_t capacity, size, used;
+	HashEntry *entries;
+} HashIndex;
+
+typedef struct idindex_s {
+	size_t capacity;
+	void **slots;
+	HashIndex *sparse;
+} IDIndex;
+
+typedef struct bloomfilter_s {
+	uint32_t nblocks;
+	uint32_t nkeys;
+	uint64_t *blocks;
+} BloomFilter;
+
+typedef struct radixnode_s {
+	char *label;
+	uint32_t len;
+	uint32_t nchild, child_capacity;
+	uint32_t nvalue, value_capacity;
+	struct radixnode_s **children;
+	void **values;
+} RadixNode;
+
+typedef struct radixtrie_s {
+	RadixNode root;
+	bool multibyte;   //@ ǷGBKַ߽з
+	size_t nkeys;
+	size_t nnodes;
+} RadixTrie;
+
+typedef void(TPTaskFn)(void *args);
+
+typedef struct tptask_s {
+	struct tptask_s *next;
+	TPTaskFn *fn;
+	void *args;
+} TPTask;
+
+typedef struct threadpool_s {
+	pthread_mutex_t lock;
+	pthread_cond_t notify, idle;
+	TPTask *head, *tail;
+	size_t pending;
+	size_t nthreads;
+	bool shutdown;
+	pthread_t *threads;
+} ThreadPool;
+
+typedef struct scanlane_s {
+	pthread_mutex_t lock;
+	size_t next, end; //@ ɨmorsel䣬߳ȡǰˣȡȡ
+} ScanLane;
+
+typedef struct scanmorsel_s {
+	void **matches;
+	size_t num;
+	bool finished;
+} ScanMorsel;
+
+typedef struct scanjob_s {
+	void **records;
+	size_t nrecords;
+	TLMatchFn *match;
+	TLVisitFn *visit;    //@ NULLʱʣռ
+	void *args;
+	size_t limit;        //@ 0ʱֻ谴ǰlimit
+	ScanLane *lanes;
+	size_t nlanes, next_lane;
+	ScanMorsel *morsels;
+	size_t nmorsels;
+	pthread_mutex_t lock;
+	pthread_cond_t finish;
+	size_t done;         //@ ɻmorsel
+	size_t frontier;     //@ ǰmorsel
+	size_t found;        //@ frontierǰĽ
+	size_t bound;        //@ Ŵboundmorselɨ
+	size_t refs;         //@ δ˳
+} ScanJob;
+
+typedef struct iorequest_s {
+	void *data;
+	size_t size;
+	int64_t offset;
+	bool succeed;
+} IORequest;
+
+#ifdef LIBSYS_IO_URING
+typedef struct uring_s {
+	int fd;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	unsigned sq_pending;      //@ дδύĶβ
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_size, cq_ring_size;
+} URing;
+#endif
+
+typedef struct iobackend_s {
+#ifdef LIBSYS_IO_URING
+	URing ring;
+	bool ring_ready;
+#endif
+	pthread_mutex_t lock;     //@ ύдл
+	uint8_t *staging;         //@ עд
+	size_t staging_size;
+	uint64_t syscalls;        //@ дͬϵͳô
+} IOBackend;
 
 typedef struct timestamp_s {
 	int16_t year;
@@ -78,52 +218,512 @@ typedef struct accountrecord_s {
 typedef struct bookrecord_s {
 	size_t stock;           //@ 
 	char ISBN[24];          //@ ISBN
-	char author[32];        //@ 
-	char name[64];          //@ 
+	uint32_t author;        //@ ߣַؾ
+	uint32_t name;          //@ ַؾ
 	Timestamp tm_introduce; //@ ʱ
+	uint32_t borrow_count;  //@ ۼƽĴ
+	uint64_t isbn;          //@ ISBN
 } BookRecord;
 
+typedef struct bookrecordv0_s {
+	size_t stock;
+	char ISBN[24];
+	char author[32];
+	char name[64];
+	Timestamp tm_introduce;
+} BookRecordV0;
+
 typedef struct borrowrecord_s {
-	char ISBN[24];        //@ ISBN
+	uint64_t isbn;        //@ ISBN
 	uint32_t loan_time;   //@ 
 	uint32_t borrower_id; //@ ID
 	Timestamp tm_borrow;  //@ ʱ
 	Timestamp tm_return;  //@ 黹ʱ
 } BorrowRecord;
 
+typedef struct borrowrecordv1_s {
+	char ISBN[24];
+	uint32_t loan_time;
+	uint32_t borrower_id;
+	Timestamp tm_borrow;
+	Timestamp tm_return;
+} BorrowRecordV1;
+
+typedef struct holdrecord_s {
+	uint64_t isbn;        //@ ISBN
+	uint32_t patron_id;   //@ ԤԼID
+	uint32_t unused;
+	Timestamp tm_reserve; //@ ԤԼʱ
+	Timestamp tm_ready;   //@ ݱʱ䣬ȺΪ-1
+} HoldRecord;
+
+typedef struct holdqueue_s {
+	uint64_t isbn;
+	TListNode **slots;
+	uint32_t head, size, capacity;
+} HoldQueue;
+
 typedef struct librarydbinfo_s {
 	uint16_t account_rec_size;
 	uint16_t book_rec_size;
 	uint16_t borrow_rec_size;
-	uint16_t unused_1;
+	uint16_t version;
 	uint32_t account_rec_num;
 	uint32_t book_rec_num;
 	uint32_t borrow_rec_num;
-	uint32_t unused_2;
+	uint32_t next_account_id;
 } LibraryDBInfo;
 
+#define SHARD_MAGIC 0x44524853
+#define DB_SHARDS 8
+#define DB_MAX_SHARDS 64
+
+typedef struct dbmanifest_s {
+	LibraryDBInfo header;
+	uint32_t nshards;     //@ ΪƬǰ
+	uint32_t unused;
+} DBManifest;
+
+typedef struct historyfileinfo_s {
+	uint32_t magic;
+	uint32_t nsnapshots;
+	uint32_t nsegments;
+	uint32_t unused;
+} HistoryFileInfo;
+
+typedef struct snapshotinfo_s {
+	uint64_t lsn;         //@ ־
+	uint64_t tm;          //@ ʱ̣ѹʱ
+} SnapshotInfo;
+
+typedef struct segmentinfo_s {
+	uint64_t first_lsn;
+	uint64_t last_lsn;
+} SegmentInfo;
+
+typedef struct history_s {
+	char *path;
+	uint32_t interval;        //@ ռı
+	uint32_t keep;            //@ 
+	SnapshotInfo *snapshots;  //@ 
+	uint32_t nsnapshots;
+	SegmentInfo *segments;    //@ 
+	uint32_t nsegments;
+} History;
+
+typedef struct shardfileinfo_s {
+	uint32_t magic;
+	uint16_t shard;
+	uint16_t nshards;
+	uint64_t generation;
+	uint32_t account_rec_num;
+	uint32_t book_rec_num;
+	uint32_t borrow_rec_num;
+	uint16_t account_rec_size;
+	uint16_t book_rec_size;
+	uint16_t borrow_rec_size;
+	uint16_t unused;
+} ShardFileInfo;
+
+typedef struct checksuminfo_s {
+	uint64_t data_size;   //@ УĿճ
+	uint32_t block_size;
+	uint32_t nblocks;
+	uint32_t table_crc;   //@ УУ
+	uint32_t magic;
+} ChecksumInfo;
+
+typedef struct verifypart_s {
+	const char *path;
+	const ChecksumInfo *info;
+	const uint32_t *table;
+	uint32_t begin, end;
+	uint32_t nbad, first_bad;
+} VerifyPart;
+
+typedef struct scrubjob_s {
+	char *path;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	bool started, running;
+	bool readable;        //@ У
+	uint32_t nblocks, nbad, first_bad;
+	double seconds;
+	Timestamp tm_finish;
+} ScrubJob;
+
+typedef struct dbmeta_s {
+	uint64_t journal_lsn;   //@ ־
+	uint64_t archive_count; //@ նӦĹ鵵¼
+	uint64_t archive_bytes; //@ նӦĹ鵵Ч
+} DBMeta;
+
+typedef struct stringpool_s {
+	char **strings;
+	char **keys;        //@ stringsͬļԭͬʱõַ
+	uint32_t count, capacity;
+	HashIndex *lookup;
+	char *arena;
+	size_t arena_left;
+	TList *chunks;
+	size_t bytes;
+} StringPool;
+
+typedef struct hitcounter_s {
+	uint64_t isbn;
+	uint32_t count;
+	uint32_t error;
+} HitCounter;
+
+#define HH_CAPACITY 256
+#define HH_WINDOW_NUM 32
+
+typedef struct hitwindow_s {
+	int32_t day;
+	uint32_t size;
+	HitCounter counters[HH_CAPACITY];
+} HitWindow;
+
+typedef struct heavyhitters_s {
+	HitWindow windows[HH_WINDOW_NUM];
+} HeavyHitters;
+
+#define CB_TOP_N 8
+
+typedef struct pairtable_s {
+	uint64_t *keys;
+	uint32_t *counts;
+	size_t capacity, size;
+} PairTable;
+
+typedef struct patronhistory_s {
+	uint32_t *rows;
+	uint32_t size, capacity;
+} PatronHistory;
+
+typedef struct coborrowindex_s {
+	void **books;
+	uint32_t nrows, capacity;
+	HashIndex *rows;
+	HashIndex *patrons;
+	PairTable *pairs;
+	uint32_t *neighbors;
+	uint32_t *weights;
+	uint8_t *degree;
+} CoBorrowIndex;
+
+enum SearchField { SearchISBN = 0, SearchName, SearchAuthor, SearchPrefix };
+
+typedef struct searchentry_s {
+	struct searchentry_s *prev, *next;
+	int field;
+	uint32_t hashkey;
+	char *pattern;
+	void **results;
+	size_t num;
+	size_t bytes;
+} SearchEntry;
+
+typedef struct searchcache_s {
+	SearchEntry *head, *tail;
+	HashIndex *lookup;
+	HashIndex *rows;
+	size_t entries, bytes;
+	size_t max_entries, max_bytes;
+	uint64_t hits, misses, invalidations;
+} SearchCache;
+
+typedef struct bytebuffer_s {
+	uint8_t *data;
+	size_t size, capacity;
+} ByteBuffer;
+
+typedef struct borrowarchive_s {
+	char *path;
+	TList *pending;
+	uint64_t count;
+	uint64_t bytes;   //@ 鵵ļЧȣΪδύ
+	bool rewrite;     //@ ɰ룬´ʱд
+} BorrowArchive;
+
+typedef struct archivecursor_s {
+	FILE *fp;
+	uint64_t remaining;
+	uint64_t chunk_remaining;
+	TListNode *pending;
+	BorrowRecord prev;
+} ArchiveCursor;
+
+enum MutationOp {
+	OpRegister = 1, OpCancel, OpResetPassword, OpRecharge,
+	OpAddBook, OpBorrow, OpReturn, OpReserve,
+};
+
+typedef struct mutation_s {
+	int op;
+	uint32_t id;       //@ ˻ID
+	uint64_t isbn;     //@ ISBN
+	int64_t value;     //@ 
+	Timestamp tm;      //@ ʱ
+	Timestamp tm_ref;  //@ 黹ʱΪԭʱ
+	char text[3][64];  //@ ˻룬ISBN
+	int64_t result;    //@ ִнд־
+	bool durable;      //@ Ƿ
+} Mutation;
+
+typedef void(JournalShipFn)(void *args, const uint8_t *data, size_t size, uint64_t lsn);
+
+typedef struct journal_s {
+	int fd;
+	int64_t offset;        //@ һдλ
+	IOBackend *io;         //@ ύ̶߳ռύڼд֮
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t flushed;
+	pthread_t committer;
+	ByteBuffer pending;
+	uint64_t appended_lsn;
+	uint64_t durable_lsn;
+	uint32_t max_wait_us;  //@ ȴ
+	JournalShipFn *ship;   //@ ̺ת͸ֻ
+	void *ship_args;
+	bool failed;
+	bool shutdown;
+	uint64_t batches, entries;
+} Journal;
+
+typedef void(AccountCancelFn)(void *args, AccountRecord *account);
+
+typedef struct checkpointer_s {
+	struct librarydb_s *db;
+	char *path;
+	pthread_t thread;
+	pthread_mutex_t lock;   //@ ״̬
+	pthread_cond_t wake;
+	uint32_t interval;      //@ ı
+	uint64_t due_lsn;       //@ һյڵ־
+	bool requested;
+	bool shutdown;
+} Checkpointer;
+
 typedef struct librarydb_s {
 	LibraryDBInfo header;
+	pthread_mutex_t lock;         //@ л
+	uint64_t journal_lsn;         //@ Ӧõ־
+	Journal *Log;                 //@ ־
+	IOBackend *IO;                //@ ļд
+	ThreadPool *Workers;          //@ ɨ̳߳أɴ߳
+	uint32_t nshards;             //@ ¼Ƭ
+	uint64_t *ShardGenerations;   //@ Ƭļĵǰ
+	uint64_t dirty_shards;        //@ ϴμķƬ
+	int32_t hold_day;             //@ ϴڱ
+	History *History;             //@ ʱָĿ־
+	Checkpointer *Checkpoint;     //@ ̨
+	AccountCancelFn *cancel_hook; //@ ˻עʱͷż¼ǰãرỰ
+	void *cancel_args;
 	TList *AccountRecords;
 	TList *BookRecords;
 	TList *BorrowRecords;
+	TList *HoldRecords;
+	HashIndex *AccountIndex; //@ ˻ϣ
+	IDIndex *AccountIDIndex; //@ ˻ID
+	HashIndex *BookIndex;    //@ ISBN
+	HashIndex *LoanIndex;    //@ δ黹
+	HashIndex *AuthorIndex;  //@ ߾
+	StringPool *Strings;     //@ ַ
+	BloomFilter *AccountFilter; //@ ˻
+	BloomFilter *BookFilter;    //@ ISBN
+	BorrowArchive *BorrowHistory; //@ ѹ黹Ĺ鵵
+	HeavyHitters *Popularity;     //@ մڵĽȶ
+	CoBorrowIndex *CoBorrow;      //@ ͬƼ
+	SearchCache *Searches;        //@ 
+	RadixTrie *ISBNTrie;          //@ 淶ISBNǰ׺
+	RadixTrie *TitleTrie;         //@ ǰ׺
+	HashIndex *HoldIndex;         //@ ISBNԤԼȺ
+	HashIndex *Inbox;             //@ ѵԤԼԤԼID
 } LibraryDB;
 
+enum ReportItem {
+	ReportFines       = 0x01,
+	ReportGroupLoans  = 0x02,
+	ReportOverdue     = 0x04,
+	ReportAuthorStock = 0x08,
+	ReportAll         = 0x0F,
+};
+
+typedef struct dbshard_s {
+	LibraryDB *db;
+	const char *path;
+	uint32_t index;
+	uint64_t generation;
+	TList *accounts, *books, *borrows; //@ ʱķƬ˽
+	ByteBuffer image;                  //@ ʱķƬӳ
+	IOBackend *io;                     //@ дú
+	bool succeed;
+} DBShard;
+
+typedef struct report_s {
+	int items;
+	int64_t fines;           //@ Ƿܶ֣
+	uint32_t debtors;        //@ Ƿ˻
+	uint32_t group_loans[3]; //@ ûڽ
+	uint32_t overdue;        //@ δ
+	uint32_t nauthors;
+	uint64_t *author_stock;  //@ ߾  ݲ
+} Report;
+
 typedef struct session_s {
 	AccountRecord *host_ref;
 	Timestamp tm_establish;
+	uint64_t token;                //@ Ự
+	int64_t deadline;              //@ еʱ̣룩ڶд
+	int64_t expire;                //@ ʱеǼǵĵڿ̶
+	struct session_s *prev, *next; //@ ʱֲλ
+	struct session_s **bucket;
 } Session, *SessionID;
 
+#define TW_LEVELS 4
+#define TW_SLOT_BITS 6
+#define TW_SLOTS (1 << TW_SLOT_BITS)
+
+typedef struct timerwheel_s {
+	int64_t now;                         //@ ǰ̶ȣ룩
+	Session *slots[TW_LEVELS][TW_SLOTS];
+} TimerWheel;
+
+#define SM_STRIPES 16
+
+typedef struct sessionstripe_s {
+	pthread_mutex_t lock;
+	HashIndex *sessions;
+} SessionStripe;
+
+typedef struct sessionmanager_s {
+	SessionStripe stripes[SM_STRIPES];
+	pthread_mutex_t wheel_lock;
+	TimerWheel wheel;
+	uint32_t idle;   //@ гʱ
+	uint64_t seed;
+	size_t count;
+} SessionManager;
+
+enum TraceOp { TraceLogin = 32, TraceSearch };
+
+typedef struct traceevent_s {
+	int op;               //@ TraceOp
+	uint64_t token;       //@ Ự
+	int64_t start_us;     //@ Ըٿʼķʱ
+	uint32_t latency_us;
+	uint32_t id;
+	uint64_t isbn;
+	int64_t value;        //@ ֵֶ
+	char text[3][64];
+} TraceEvent;
+
+typedef struct tracerecorder_s {
+	FILE *fp;
+	pthread_mutex_t lock;
+	int64_t begin_us;
+	int64_t last_us;
+	uint64_t events;
+} TraceRecorder;
+
 typedef struct bootinfo_s {
 	char root[256];
+	char db_file[512];    //@ ǿʱrootµĬݿ
+	bool replica;         //@ ֻд־
+	bool history;         //@ ־֧ʱָ
 } BootInfo;
 
+enum ReplFrameType {
+	ReplHello = 1,  //@  -> ݿ·
+	ReplSubscribe,  //@  -> ⣺Ӧ
+	ReplEntries,    //@  -> ־
+	ReplHeartbeat,  //@  -> 
+	ReplAck,        //@  -> ⣺ӦӦӳ
+};
+
+typedef struct replframe_s {
+	uint32_t type;
+	uint32_t size;        //@ س
+	uint64_t lsn;
+	int64_t stamp_us;     //@ ʱ̣ӦΪӦӳ
+} ReplFrame;
+
+typedef struct replicalink_s {
+	int fd;
+	uint32_t id;
+	bool streaming;       //@ ׷
+	uint64_t acked_lsn;
+	int64_t lag_us;       //@ Ӧӳ
+	int64_t ack_us;       //@ Ӧʱ
+} ReplicaLink;
+
+#define REPL_MAX_LINKS 16
+
+typedef struct replicahub_s {
+	char *db_path;
+	char *address;
+	int listen_fd;
+	int wake[2];
+	pthread_t thread;
+	pthread_mutex_t lock;
+	ByteBuffer pending;     //@ ̴͵־
+	uint64_t published_lsn;
+	ReplicaLink links[REPL_MAX_LINKS];
+	uint32_t nlinks, next_id;
+	bool shutdown;
+} ReplicaHub;
+
+typedef struct replicaclient_s {
+	int fd;
+	LibraryDB *db;
+	pthread_t thread;
+	pthread_mutex_t lock;   //@ ״̬
+	uint64_t primary_lsn;   //@ 
+	int64_t lag_us;         //@ ԷӦ
+	int64_t contact_us;     //@ յϢʱ
+	uint64_t frames;
+	bool connected;
+} ReplicaClient;
+
 typedef struct librarysystem_s {
 	char *db_path;
+	ThreadPool *workers;
 	LibraryDB database;
-	SessionID session;
+	SessionManager *sessions;
+	ScrubJob *scrub;
+	TraceRecorder *trace;
+	ReplicaHub *hub;          //@ ־
+	ReplicaClient *replica;   //@ ֻ־
+	bool readonly;            //@ ֻʷͼ
+	uint64_t token;
+	SessionID session;        //@ ָcurrentΪNULL
+	Session current;          //@ ǰỰĸỰ󱻻ҲʧЧ
 } LibSysDescription, *LibrarySystem;
 
+typedef struct replayaccounts_s {
+	pthread_mutex_t lock;
+	HashIndex *names;     //@ ¼ʱ˻ID˻
+} ReplayAccounts;
+
+typedef struct replaysession_s {
+	uint64_t token;       //@ ¼ʱĻỰ
+	LibSysDescription sys;
+} ReplaySession;
+
+typedef struct replayworker_s {
+	LibrarySystem sys;
+	ReplayAccounts *accounts;
+	HashIndex *sessions;  //@ ̻߳طŵĻỰ¼ʱĻỰ
+	const TraceEvent *events;
+	size_t nevents;
+	uint32_t *latency;    //@ طźʱ¼±
+	uint32_t index, nthreads;
+	bool paced;
+	int64_t begin_us;
+} ReplayWorker;
+
 /// 
 uint32_t hash(const char *str) {
 	register uint32_t hash_ = 5381;
@@ -133,27 +733,397 @@ uint32_t hash(const char *str) {
 	return hash_ & 0x7fffffff;
 }
 
+uint64_t hash64(const char *str) {
+	uint64_t hash_ = 0xcbf29ce484222325ull;
+	while (*str) {
+		hash_ ^= (uint8_t)*str++;
+		hash_ *= 0x100000001b3ull;
+	}
+	return hash_;
+}
+
+//! ֻĽ߳̽ڵȴڼͷſ߳Ӧ־
+//! ³resume½Ựǰȡõļ¼ָ
+typedef struct inputyield_s {
+	pthread_mutex_t *lock;
+	void (*resume)(void *args);
+	void *args;
+} InputYieldInfo;
+
+static InputYieldInfo *InputYield;
+
+static void InputPause() {
+	if (InputYield != NULL) pthread_mutex_unlock(InputYield->lock);
+}
+
+static void InputResume() {
+	if (InputYield == NULL) return;
+	pthread_mutex_lock(InputYield->lock);
+	InputYield->resume(InputYield->args);
+}
+
 int getoption(const char *prompt) {
 	char c;
 	if (prompt != NULL) {
 		printf(prompt);
 	}
+	InputPause();
 	while (isspace(c = getchar())) {}
+	InputResume();
 	return c;
 }
 
 int getline(const char *prompt, char *buffer) {
+	InputPause();
 	while (isblank(getchar())) {}
 	if (prompt != NULL) {
 		printf(prompt);
 	}
-	return scanf("%[^\n]", buffer);
+	int result = scanf("%[^\n]", buffer);
+	InputResume();
+	return result;
 }
 
 void clear() {
 	system("cls");
 }
 
+size_t GetProcessorNum() {
+#ifdef _WIN32
+	const char *nproc = getenv("NUMBER_OF_PROCESSORS");
+	long n = nproc != NULL ? atol(nproc) : 1;
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	return n > 0 ? n : 1;
+}
+
+//! λȡfdÿ̹߳
+bool ReadAt(int fd, void *buffer, size_t size, int64_t offset) {
+	char *p = (char*)buffer;
+	while (size > 0) {
+#ifdef _WIN32
+		if (_lseeki64(fd, offset, SEEK_SET) < 0) return false;
+		int n = _read(fd, p, size > INT_MAX ? INT_MAX : size);
+#else
+		ssize_t n = pread(fd, p, size, offset);
+#endif
+		if (n <= 0) return false;
+		p += n;
+		size -= n;
+		offset += n;
+	}
+	return true;
+}
+
+bool WriteAt(int fd, const void *buffer, size_t size, int64_t offset) {
+	const char *p = (const char*)buffer;
+	while (size > 0) {
+#ifdef _WIN32
+		if (_lseeki64(fd, offset, SEEK_SET) < 0) return false;
+		int n = _write(fd, p, size > INT_MAX ? INT_MAX : size);
+#else
+		ssize_t n = pwrite(fd, p, size, offset);
+#endif
+		if (n <= 0) return false;
+		p += n;
+		size -= n;
+		offset += n;
+	}
+	return true;
+}
+
+bool DuplicateFile(const char *src, const char *dst) {
+	FILE *in = fopen(src, "rb");
+	if (in == NULL) return false;
+	FILE *out = fopen(dst, "wb");
+	bool succeed = out != NULL;
+	char block[65536];
+	size_t n = 0;
+	while (succeed && (n = fread(block, 1, sizeof(block), in)) > 0) {
+		succeed = fwrite(block, 1, n, out) == n;
+	}
+	fclose(in);
+	if (out) fclose(out);
+	return succeed;
+}
+
+//! Ӳӣļϵͳ֧ʱ˻ظ
+bool LinkFile(const char *src, const char *dst) {
+	remove(dst);
+#ifndef _WIN32
+	if (link(src, dst) == 0) return true;
+#endif
+	return DuplicateFile(src, dst);
+}
+
+//! ͬ
+bool SyncFile(int fd) {
+#ifdef _WIN32
+	return _commit(fd) == 0;
+#else
+	return fsync(fd) == 0;
+#endif
+}
+
+bool TruncateFile(const char *path, int64_t size) {
+#ifdef _WIN32
+	int fd = open(path, O_RDWR | O_BINARY);
+	if (fd < 0) return false;
+	bool succeed = _chsize_s(fd, size) == 0;
+	close(fd);
+	return succeed;
+#else
+	return truncate(path, size) == 0;
+#endif
+}
+
+/// 첽IO
+//! LIBSYS_IO_URINGʱֱӾϵͳʹio_uringliburingں˲֧ʱ˻ضλд
+#define IO_QUEUE_DEPTH 64
+#define IO_STAGING_BYTES (256 << 10)
+#define IO_CHUNK_BYTES (1 << 20)
+
+#ifdef LIBSYS_IO_URING
+static int URingEnter(URing *ring, unsigned submit, unsigned wait) {
+	int ret;
+	do {
+		ret = syscall(__NR_io_uring_enter, ring->fd, submit, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	} while (ret < 0 && errno == EINTR);
+	return ret;
+}
+
+static void URingExit(URing *ring) {
+	if (ring->sqes != NULL) munmap(ring->sqes, IO_QUEUE_DEPTH * sizeof(struct io_uring_sqe));
+	if (ring->cq_ring != NULL) munmap(ring->cq_ring, ring->cq_ring_size);
+	if (ring->sq_ring != NULL) munmap(ring->sq_ring, ring->sq_ring_size);
+	close(ring->fd);
+	memset(ring, 0, sizeof(URing));
+}
+
+static bool URingInit(URing *ring) {
+	struct io_uring_params params = { };
+	memset(ring, 0, sizeof(URing));
+	ring->fd = syscall(__NR_io_uring_setup, IO_QUEUE_DEPTH, &params);
+	if (ring->fd < 0) return false;
+	ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	ring->sqes = (struct io_uring_sqe*)mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe),
+		PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sq_ring == MAP_FAILED) ring->sq_ring = NULL;
+	if (ring->cq_ring == MAP_FAILED) ring->cq_ring = NULL;
+	if (ring->sqes == MAP_FAILED) ring->sqes = NULL;
+	if (ring->sq_ring == NULL || ring->cq_ring == NULL || ring->sqes == NULL || params.sq_entries != IO_QUEUE_DEPTH) {
+		URingExit(ring);
+		return false;
+	}
+	uint8_t *sq = (uint8_t*)ring->sq_ring, *cq = (uint8_t*)ring->cq_ring;
+	ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+	ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+	ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+	ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+	ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+	ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+	ring->sq_pending = *ring->sq_tail;
+	return true;
+}
+
+//! ȡһеύʱNULL
+static struct io_uring_sqe* URingGetSQE(URing *ring, int op, int fd, const void *addr, size_t len, int64_t offset, void *data) {
+	unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	if (ring->sq_pending - head >= IO_QUEUE_DEPTH) return NULL;
+	unsigned index = ring->sq_pending & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->opcode = op;
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t)addr;
+	sqe->len = len;
+	sqe->off = offset;
+	sqe->user_data = (uintptr_t)data;
+	ring->sq_array[index] = index;
+	++ring->sq_pending;
+	return sqe;
+}
+
+//! ύȫд󲢵ȴwait¼
+static bool URingSubmitAndWait(URing *ring, unsigned wait) {
+	unsigned submit = ring->sq_pending - *ring->sq_tail;
+	__atomic_store_n(ring->sq_tail, ring->sq_pending, __ATOMIC_RELEASE);
+	while (submit > 0) {
+		int ret = URingEnter(ring, submit, wait);
+		if (ret <= 0) return false;
+		submit -= ret;
+		wait = 0;
+	}
+	return true;
+}
+
+static struct io_uring_cqe* URingWaitCQE(URing *ring) {
+	while (true) {
+		unsigned head = *ring->cq_head;
+		if (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+			return &ring->cqes[head & *ring->cq_mask];
+		}
+		if (URingEnter(ring, 0, 1) < 0) return NULL;
+	}
+}
+
+static void URingSeen(URing *ring) {
+	__atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+#endif
+
+IOBackend* MakeIOBackend() {
+	IOBackend *io = (IOBackend*)calloc(1, sizeof(IOBackend));
+	pthread_mutex_init(&io->lock, NULL);
+#ifdef LIBSYS_IO_URING
+	if (URingInit(&io->ring)) {
+		io->ring_ready = true;
+		io->staging = (uint8_t*)malloc(IO_STAGING_BYTES);
+		struct iovec iov = { io->staging, IO_STAGING_BYTES };
+		if (syscall(__NR_io_uring_register, io->ring.fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0) {
+			io->staging_size = IO_STAGING_BYTES;
+		}
+	}
+#endif
+	return io;
+}
+
+void IODestroy(IOBackend *io) {
+	if (!io) return;
+#ifdef LIBSYS_IO_URING
+	if (io->ring.sq_ring != NULL) URingExit(&io->ring);
+#endif
+	free(io->staging);
+	pthread_mutex_destroy(&io->lock);
+	free(io);
+}
+
+bool IOBatched(IOBackend *io) {
+#ifdef LIBSYS_IO_URING
+	return io != NULL && io->ring_ready;
+#else
+	return false;
+#endif
+}
+
+#ifdef LIBSYS_IO_URING
+//! ȡcount¼һʧ-ECANCELED
+static bool IOReap(IOBackend *io, unsigned count) {
+	bool succeed = true;
+	for (unsigned i = 0; i < count; ++i) {
+		struct io_uring_cqe *cqe = URingWaitCQE(&io->ring);
+		if (cqe == NULL) {
+			io->ring_ready = false; // completions lost, stop using the ring
+			return false;
+		}
+		IORequest *req = (IORequest*)(uintptr_t)cqe->user_data;
+		bool done = cqe->res >= 0 && (req == NULL || (size_t)cqe->res == req->size);
+		if (req != NULL) req->succeed = done;
+		succeed = succeed && done;
+		URingSeen(&io->ring);
+	}
+	return succeed;
+}
+
+//! д˴ӲfdatasyncβСעỺдһύ
+static bool URingWriteSync(IOBackend *io, int fd, const uint8_t *data, size_t size, int64_t offset) {
+	IORequest reqs[IO_QUEUE_DEPTH];
+	bool fixed = size <= io->staging_size;
+	if (fixed) {
+		memcpy(io->staging, data, size);
+		data = io->staging;
+	}
+	while (true) {
+		unsigned n = 0;
+		struct io_uring_sqe *sqe = NULL;
+		while (size > 0 && n + 1 < IO_QUEUE_DEPTH) {
+			size_t len = size < IO_CHUNK_BYTES ? size : IO_CHUNK_BYTES;
+			reqs[n].size = len;
+			sqe = URingGetSQE(&io->ring, fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE, fd, data, len, offset, &reqs[n]);
+			sqe->flags |= IOSQE_IO_LINK;
+			data += len;
+			size -= len;
+			offset += len;
+			++n;
+		}
+		bool last = size == 0;
+		if (last) {
+			sqe = URingGetSQE(&io->ring, IORING_OP_FSYNC, fd, NULL, 0, 0, NULL);
+			sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+		} else {
+			sqe->flags &= ~IOSQE_IO_LINK;
+		}
+		++io->syscalls;
+		if (!URingSubmitAndWait(&io->ring, n + last)) {
+			io->ring_ready = false;
+			return false;
+		}
+		if (!IOReap(io, n + last)) return false;
+		if (last) return true;
+	}
+}
+#endif
+
+//! д벢ͬʧʱԶλд
+bool IOWriteSync(IOBackend *io, int fd, const void *data, size_t size, int64_t offset) {
+	pthread_mutex_lock(&io->lock);
+#ifdef LIBSYS_IO_URING
+	if (io->ring_ready && URingWriteSync(io, fd, (const uint8_t*)data, size, offset)) {
+		pthread_mutex_unlock(&io->lock);
+		return true;
+	}
+#endif
+	io->syscalls += 2;
+	pthread_mutex_unlock(&io->lock);
+	return WriteAt(fd, data, size, offset) && SyncFile(fd);
+}
+
+//! λȡio_uringһύȫ󣬶̶ʧܵ˻ȡ
+bool IOReadBatch(IOBackend *io, int fd, IORequest *reqs, size_t n) {
+	for (size_t i = 0; i < n; ++i) {
+		reqs[i].succeed = reqs[i].size == 0;
+	}
+#ifdef LIBSYS_IO_URING
+	pthread_mutex_lock(&io->lock);
+	for (size_t i = 0; io->ring_ready && i < n; ) {
+		unsigned count = 0;
+		for (; i < n && count < IO_QUEUE_DEPTH; ++i) {
+			if (reqs[i].succeed || reqs[i].size > UINT_MAX) continue;
+			URingGetSQE(&io->ring, IORING_OP_READ, fd, reqs[i].data, reqs[i].size, reqs[i].offset, &reqs[i]);
+			++count;
+		}
+		if (count == 0) break;
+		++io->syscalls;
+		if (!URingSubmitAndWait(&io->ring, count)) {
+			io->ring_ready = false;
+			break;
+		}
+		IOReap(io, count);
+	}
+	pthread_mutex_unlock(&io->lock);
+#endif
+	bool succeed = true;
+	for (size_t i = 0; i < n; ++i) {
+		if (!reqs[i].succeed) {
+			reqs[i].succeed = ReadAt(fd, reqs[i].data, reqs[i].size, reqs[i].offset);
+		}
+		succeed = succeed && reqs[i].succeed;
+	}
+	return succeed;
+}
+
+const char* IOBackendName(IOBackend *io) {
+	return IOBatched(io) ? "io_uring" : "pread/pwrite";
+}
+
 /// ֧ͨ
 TList* MakeTList(size_t node_size) {
 	assert(node_size >= 1);
@@ -196,6 +1166,35 @@ void* TLAppend(TList *list, void *data) {
 	return node->data;
 }
 
+//! srcȫڵdstβ
+//! 鲢Ľڵdstβͬʱǰ
+void TLMerge(TList *dst, TList **srcs, size_t num, uint64_t (*key)(const void *data)) {
+	while (true) {
+		size_t min = num;
+		uint64_t min_key = 0;
+		for (size_t i = 0; i < num; ++i) {
+			if (srcs[i]->head == NULL) continue;
+			uint64_t k = key(srcs[i]->head->data);
+			if (min == num || k < min_key) {
+				min = i;
+				min_key = k;
+			}
+		}
+		if (min == num) break;
+		TListNode *node = srcs[min]->head;
+		srcs[min]->head = node->next;
+		if (node->next == NULL) srcs[min]->tail = NULL;
+		node->prev = dst->tail;
+		node->next = NULL;
+		if (dst->tail != NULL) {
+			dst->tail->next = node;
+		} else {
+			dst->head = node;
+		}
+		dst->tail = node;
+	}
+}
+
 bool TLErase(TList *list, TListNode *node) {
 	if (!list || !list->head || !node) return false;
 	if (node->prev) {
@@ -228,6 +1227,21 @@ void* TLFind(TList *list, void *data, bool retnode) {
 	return NULL;
 }
 
+//! ڵָ飬Ƭд
+void** TLSnapshot(TList *list, size_t *num) {
+	size_t count = 0, capacity = 64;
+	void **records = (void**)malloc(capacity * sizeof(void*));
+	for (TListNode *p = list ? list->head : NULL; p != NULL; p = p->next) {
+		if (count == capacity) {
+			capacity *= 2;
+			records = (void**)realloc(records, capacity * sizeof(void*));
+		}
+		records[count++] = p->data;
+	}
+	*num = count;
+	return records;
+}
+
 //! Զ
 void* TLMatch(TList *list, TLMatchFn match, void *args, bool retnode) {
 	if (!list || !list->head) return NULL;
@@ -241,86 +1255,2919 @@ void* TLMatch(TList *list, TLMatchFn match, void *args, bool retnode) {
 	return NULL;
 }
 
-/// ʱ亯
-void TimeToTimestamp(Timestamp *stamp, time_t tm) {
-	struct tm *detail = localtime(&tm);
-	stamp->year = detail->tm_year + 1900;
-	stamp->month = detail->tm_mon + 1;
-	stamp->day = detail->tm_mday;
-	stamp->weekday = detail->tm_wday + 1;
-	stamp->hour = detail->tm_hour;
-	stamp->min = detail->tm_min;
-	stamp->sec = detail->tm_sec;
-}
+/// ϣ֧
+//! ظɵ÷ƥ亯
+static HashEntry HITombstone;
+#define HI_TOMBSTONE ((void*)&HITombstone)
 
-void GetTimestamp(Timestamp *stamp) {
-	assert(stamp != NULL);
-	time_t rawtime;
-	time(&rawtime);
-	TimeToTimestamp(stamp, rawtime);
+static inline size_t HISlot(HashIndex *index, uint32_t key) {
+	key ^= key >> 16;
+	key *= 0x85ebca6b;
+	key ^= key >> 13;
+	key *= 0xc2b2ae35;
+	key ^= key >> 16;
+	return key & (index->capacity - 1);
 }
 
-double GetDuration(Timestamp *begin, Timestamp *end) {
-	assert(begin != NULL);
-	assert(end != NULL);
+HashIndex* MakeHashIndex(size_t hint) {
+	HashIndex *index = (HashIndex*)calloc(1, sizeof(HashIndex));
+	index->capacity = 16;
+	while (index->capacity < hint * 2) {
+		index->capacity <<= 1;
+	}
+	index->entries = (HashEntry*)calloc(index->capacity, sizeof(HashEntry));
+	return index;
+}
 
-	time_t tm_begin, tm_end;
-	struct tm detail = { };
-	detail.tm_isdst = -1;
+void HIDestroy(HashIndex *index) {
+	if (!index) return;
+	free(index->entries);
+	free(index);
+}
 
-	detail.tm_year = begin->year - 1900;
-	detail.tm_mon = begin->month - 1;
-	detail.tm_mday = begin->day;
-	detail.tm_wday = begin->weekday - 1;
-	detail.tm_hour = begin->hour;
-	detail.tm_min = begin->min;
-	detail.tm_sec = begin->sec;
-	tm_begin = mktime(&detail);
+static void HIRehash(HashIndex *index, size_t capacity) {
+	HashEntry *entries = index->entries;
+	size_t old_capacity = index->capacity;
+	index->capacity = capacity;
+	index->entries = (HashEntry*)calloc(capacity, sizeof(HashEntry));
+	index->used = index->size;
+	for (size_t i = 0; i < old_capacity; ++i) {
+		if (entries[i].ref == NULL || entries[i].ref == HI_TOMBSTONE) continue;
+		size_t slot = HISlot(index, entries[i].key);
+		while (index->entries[slot].ref != NULL) {
+			slot = (slot + 1) & (capacity - 1);
+		}
+		index->entries[slot] = entries[i];
+	}
+	free(entries);
+}
 
-	detail.tm_year = end->year - 1900;
-	detail.tm_mon = end->month - 1;
-	detail.tm_mday = end->day;
-	detail.tm_wday = end->weekday - 1;
-	detail.tm_hour = end->hour;
-	detail.tm_min = end->min;
-	detail.tm_sec = end->sec;
-	tm_end = mktime(&detail);
+void HIInsert(HashIndex *index, uint32_t key, void *ref) {
+	assert(index != NULL && ref != NULL);
+	if ((index->used + 1) * 4 >= index->capacity * 3) {
+		HIRehash(index, index->size * 2 >= index->capacity / 2
+			? index->capacity * 2 : index->capacity);
+	}
+	size_t slot = HISlot(index, key);
+	while (index->entries[slot].ref != NULL && index->entries[slot].ref != HI_TOMBSTONE) {
+		slot = (slot + 1) & (index->capacity - 1);
+	}
+	if (index->entries[slot].ref == NULL) {
+		++index->used;
+	}
+	index->entries[slot].key = key;
+	index->entries[slot].ref = ref;
+	++index->size;
+}
 
-	return difftime(tm_end, tm_begin);
+bool HIErase(HashIndex *index, uint32_t key, void *ref) {
+	if (!index) return false;
+	size_t slot = HISlot(index, key);
+	while (index->entries[slot].ref != NULL) {
+		if (index->entries[slot].key == key && index->entries[slot].ref == ref) {
+			index->entries[slot].ref = HI_TOMBSTONE;
+			--index->size;
+			return true;
+		}
+		slot = (slot + 1) & (index->capacity - 1);
+	}
+	return false;
 }
 
-/// Ȩ޹
-bool RequireService(enum UserGroup identity, enum Permission service) {
-	enum Permission access[] = {
-		[User] UserAccess, [Manager] ManagerAccess, [Admin] AdminAccess
-	};
-	return !!(access[identity] & service);
+//! Ӧȫ¼cursorʼΪ0
+void* HINext(HashIndex *index, uint32_t key, size_t *cursor) {
+	if (!index) return NULL;
+	size_t slot = *cursor == 0 ? HISlot(index, key) : *cursor & (index->capacity - 1);
+	size_t probed = *cursor == 0 ? 0 : 1;
+	while (index->entries[slot].ref != NULL && probed <= index->capacity) {
+		HashEntry *entry = &index->entries[slot];
+		slot = (slot + 1) & (index->capacity - 1);
+		++probed;
+		if (entry->ref != HI_TOMBSTONE && entry->key == key) {
+			*cursor = slot | index->capacity;
+			return entry->ref;
+		}
+	}
+	return NULL;
 }
 
-bool CheckAccess(enum UserGroup identity, enum Permission op) {
-	enum Permission access[] = {
-		[User] UserAccess, [Manager] ManagerAccess, [Admin] AdminAccess
-	};
-	return (access[identity] & op) == op;
+void* HIMatch(HashIndex *index, uint32_t key, TLMatchFn match, void *args) {
+	size_t cursor = 0;
+	void *ref = NULL;
+	while ((ref = HINext(index, key, &cursor)) != NULL) {
+		if (match == NULL || match(ref, args)) return ref;
+	}
+	return NULL;
 }
 
-/// ݹ
-bool OpenLibraryDB(LibraryDB *db, const char *path) {
-	if (!db) return false;
-	if (access(path, F_OK) != 0) {
-		FILE *fp = fopen(path, "wb+");
-		if (fp == NULL) return false;
-		memset(&db->header, 0, sizeof(LibraryDBInfo));
-		db->header.account_rec_size = sizeof(AccountRecord);
-		db->header.book_rec_size = sizeof(BookRecord);
-		db->header.borrow_rec_size = sizeof(BorrowRecord);
-		db->header.account_rec_num = 1;
-		fwrite(&db->header, sizeof(LibraryDBInfo), 1, fp);
-		db->AccountRecords = MakeTList(sizeof(AccountRecord));
-		db->BookRecords = MakeTList(sizeof(BookRecord));
-		db->BorrowRecords = MakeTList(sizeof(BorrowRecord));
+/// ID֧
+//! ֱѰַɰIDϡ
+#define ID_DENSE_LIMIT (1u << 22)
 
-		AccountRecord admin = { };
+IDIndex* MakeIDIndex(size_t hint) {
+	IDIndex *index = (IDIndex*)calloc(1, sizeof(IDIndex));
+	index->capacity = 64;
+	while (index->capacity < hint && index->capacity < ID_DENSE_LIMIT) {
+		index->capacity <<= 1;
+	}
+	index->slots = (void**)calloc(index->capacity, sizeof(void*));
+	index->sparse = MakeHashIndex(0);
+	return index;
+}
+
+void IDIDestroy(IDIndex *index) {
+	if (!index) return;
+	HIDestroy(index->sparse);
+	free(index->slots);
+	free(index);
+}
+
+void* IDIFind(IDIndex *index, uint32_t id) {
+	if (!index) return NULL;
+	if (id < index->capacity) return index->slots[id];
+	if (id < ID_DENSE_LIMIT) return NULL;
+	return HIMatch(index->sparse, id, NULL, NULL);
+}
+
+bool IDIInsert(IDIndex *index, uint32_t id, void *ref) {
+	assert(index != NULL && ref != NULL);
+	if (IDIFind(index, id) != NULL) return false;
+	if (id >= ID_DENSE_LIMIT) {
+		HIInsert(index->sparse, id, ref);
+		return true;
+	}
+	if (id >= index->capacity) {
+		size_t capacity = index->capacity;
+		while (capacity <= id) {
+			capacity <<= 1;
+		}
+		index->slots = (void**)realloc(index->slots, capacity * sizeof(void*));
+		memset(index->slots + index->capacity, 0, (capacity - index->capacity) * sizeof(void*));
+		index->capacity = capacity;
+	}
+	index->slots[id] = ref;
+	return true;
+}
+
+void IDIErase(IDIndex *index, uint32_t id, void *ref) {
+	if (!index || IDIFind(index, id) != ref) return;
+	if (id >= ID_DENSE_LIMIT) {
+		HIErase(index->sparse, id, ref);
+	} else {
+		index->slots[id] = NULL;
+	}
+}
+
+/// ¡֧
+//! ֿ鲼¡βѯֻһ
+#define BF_BLOCK_WORDS 8
+#define BF_BLOCK_BITS  (BF_BLOCK_WORDS * 64)
+#define BF_BITS_PER_KEY 10
+#define BF_HASH_NUM 7
+
+BloomFilter* MakeBloomFilter(size_t capacity) {
+	BloomFilter *filter = (BloomFilter*)calloc(1, sizeof(BloomFilter));
+	size_t nblocks = (capacity * BF_BITS_PER_KEY + BF_BLOCK_BITS - 1) / BF_BLOCK_BITS;
+	filter->nblocks = nblocks > 0 ? nblocks : 1;
+	filter->blocks = (uint64_t*)calloc(filter->nblocks, BF_BLOCK_WORDS * sizeof(uint64_t));
+	return filter;
+}
+
+void BFDestroy(BloomFilter *filter) {
+	if (!filter) return;
+	free(filter->blocks);
+	free(filter);
+}
+
+static inline uint64_t* BFBlock(BloomFilter *filter, uint64_t key) {
+	uint64_t block = ((key >> 32) * filter->nblocks) >> 32;
+	return filter->blocks + block * BF_BLOCK_WORDS;
+}
+
+void BFInsert(BloomFilter *filter, uint64_t key) {
+	if (!filter) return;
+	uint64_t *block = BFBlock(filter, key);
+	uint32_t h1 = key, h2 = (key * 0x9e3779b97f4a7c15ull) >> 32 | 1;
+	for (int i = 0; i < BF_HASH_NUM; ++i) {
+		uint32_t bit = (h1 + i * h2) % BF_BLOCK_BITS;
+		block[bit >> 6] |= 1ull << (bit & 63);
+	}
+	++filter->nkeys;
+}
+
+//! falseʾһ
+bool BFMayContain(BloomFilter *filter, uint64_t key) {
+	if (!filter) return true;
+	uint64_t *block = BFBlock(filter, key);
+	uint32_t h1 = key, h2 = (key * 0x9e3779b97f4a7c15ull) >> 32 | 1;
+	for (int i = 0; i < BF_HASH_NUM; ++i) {
+		uint32_t bit = (h1 + i * h2) % BF_BLOCK_BITS;
+		if (!(block[bit >> 6] & (1ull << (bit & 63)))) return false;
+	}
+	return true;
+}
+
+//! سʱؽ
+bool BFOverloaded(BloomFilter *filter) {
+	return (uint64_t)filter->nkeys * BF_BITS_PER_KEY > (uint64_t)filter->nblocks * BF_BLOCK_BITS;
+}
+
+BloomFilter* ReadBloomFilter(FILE *fp) {
+	BloomFilter filter = { };
+	if (fread(&filter.nblocks, sizeof(uint32_t), 1, fp) != 1) return NULL;
+	if (fread(&filter.nkeys, sizeof(uint32_t), 1, fp) != 1) return NULL;
+	if (filter.nblocks == 0) return NULL;
+	filter.blocks = (uint64_t*)malloc(filter.nblocks * BF_BLOCK_WORDS * sizeof(uint64_t));
+	if (fread(filter.blocks, BF_BLOCK_WORDS * sizeof(uint64_t), filter.nblocks, fp) != filter.nblocks) {
+		free(filter.blocks);
+		return NULL;
+	}
+	BloomFilter *result = (BloomFilter*)malloc(sizeof(BloomFilter));
+	memcpy(result, &filter, sizeof(BloomFilter));
+	return result;
+}
+
+void WriteBloomFilter(BloomFilter *filter, FILE *fp) {
+	fwrite(&filter->nblocks, sizeof(uint32_t), 1, fp);
+	fwrite(&filter->nkeys, sizeof(uint32_t), 1, fp);
+	fwrite(filter->blocks, BF_BLOCK_WORDS * sizeof(uint64_t), filter->nblocks, fp);
+}
+
+/// ֧
+//! GBK/GB18030дpַֽ
+static inline size_t GBKCharLen(const char *p, size_t left) {
+	uint8_t c = (uint8_t)p[0];
+	if (c < 0x81 || left < 2) return 1;
+	uint8_t d = (uint8_t)p[1];
+	if (d >= 0x30 && d <= 0x39 && left >= 4) return 4;
+	return 2;
+}
+
+RadixTrie* MakeRadixTrie(bool multibyte) {
+	RadixTrie *trie = (RadixTrie*)calloc(1, sizeof(RadixTrie));
+	trie->multibyte = multibyte;
+	return trie;
+}
+
+static void RTFreeNode(RadixNode *node) {
+	for (uint32_t i = 0; i < node->nchild; ++i) {
+		RTFreeNode(node->children[i]);
+		free(node->children[i]);
+	}
+	free(node->children);
+	free(node->values);
+	free(node->label);
+}
+
+void RTDestroy(RadixTrie *trie) {
+	if (!trie) return;
+	RTFreeNode(&trie->root);
+	free(trie);
+}
+
+//! ǰ׺ȣֽģʽ»ַ߽
+static size_t RTCommon(RadixTrie *trie, const char *label, size_t len, const char *key, size_t left) {
+	size_t n = 0, limit = len < left ? len : left;
+	while (n < limit) {
+		size_t step = trie->multibyte ? GBKCharLen(label + n, len - n) : 1;
+		if (n + step > limit || memcmp(label + n, key + n, step) != 0) break;
+		n += step;
+	}
+	return n;
+}
+
+static RadixNode* RTMakeNode(const char *label, size_t len) {
+	RadixNode *node = (RadixNode*)calloc(1, sizeof(RadixNode));
+	node->label = (char*)malloc(len + 1);
+	memcpy(node->label, label, len);
+	node->label[len] = '\0';
+	node->len = len;
+	return node;
+}
+
+static void RTAddChild(RadixNode *node, RadixNode *child) {
+	if (node->nchild == node->child_capacity) {
+		node->child_capacity = node->child_capacity ? node->child_capacity * 2 : 4;
+		node->children = (RadixNode**)realloc(node->children, node->child_capacity * sizeof(RadixNode*));
+	}
+	uint32_t i = node->nchild;
+	while (i > 0 && strcmp(node->children[i - 1]->label, child->label) > 0) {
+		node->children[i] = node->children[i - 1];
+		--i;
+	}
+	node->children[i] = child;
+	++node->nchild;
+}
+
+void RTInsert(RadixTrie *trie, const char *key, void *value) {
+	RadixNode *node = &trie->root;
+	size_t len = strlen(key), pos = 0;
+	while (pos < len) {
+		RadixNode *child = NULL;
+		size_t n = 0;
+		for (uint32_t i = 0; i < node->nchild && n == 0; ++i) {
+			child = node->children[i];
+			n = RTCommon(trie, child->label, child->len, key + pos, len - pos);
+		}
+		if (n == 0) {
+			child = RTMakeNode(key + pos, len - pos);
+			RTAddChild(node, child);
+			++trie->nnodes;
+			node = child;
+			break;
+		}
+		if (n < child->len) {
+			//! ֱߣмڵ̳ԭλãԭڵΪӽڵ
+			RadixNode *mid = RTMakeNode(child->label, n);
+			memmove(child->label, child->label + n, child->len - n + 1);
+			child->len -= n;
+			for (uint32_t i = 0; i < node->nchild; ++i) {
+				if (node->children[i] == child) node->children[i] = mid;
+			}
+			RTAddChild(mid, child);
+			++trie->nnodes;
+			child = mid;
+		}
+		node = child;
+		pos += n;
+	}
+	if (node->nvalue == node->value_capacity) {
+		node->value_capacity = node->value_capacity ? node->value_capacity * 2 : 1;
+		node->values = (void**)realloc(node->values, node->value_capacity * sizeof(void*));
+	}
+	node->values[node->nvalue++] = value;
+	++trie->nkeys;
+}
+
+static size_t RTCollect(RadixNode *node, void **results, size_t num, size_t max) {
+	for (uint32_t i = 0; i < node->nvalue && num < max; ++i) {
+		results[num++] = node->values[i];
+	}
+	for (uint32_t i = 0; i < node->nchild && num < max; ++i) {
+		num = RTCollect(node->children[i], results, num, max);
+	}
+	return num;
+}
+
+//! ֵ򷵻maxprefixΪǰ׺ļֵ
+size_t RTComplete(RadixTrie *trie, const char *prefix, void **results, size_t max) {
+	RadixNode *node = &trie->root;
+	size_t len = strlen(prefix), pos = 0;
+	while (pos < len) {
+		RadixNode *next = NULL;
+		size_t left = len - pos;
+		for (uint32_t i = 0; i < node->nchild && next == NULL; ++i) {
+			RadixNode *child = node->children[i];
+			size_t n = child->len < left ? child->len : left;
+			if (memcmp(child->label, prefix + pos, n) == 0) next = child;
+		}
+		if (next == NULL) return 0;
+		pos += next->len;
+		node = next;
+	}
+	return RTCollect(node, results, 0, max);
+}
+
+/// ̳֧߳
+static void* TPWorker(void *args) {
+	ThreadPool *pool = (ThreadPool*)args;
+	pthread_mutex_lock(&pool->lock);
+	while (true) {
+		while (pool->head == NULL && !pool->shutdown) {
+			pthread_cond_wait(&pool->notify, &pool->lock);
+		}
+		if (pool->head == NULL) break;
+		TPTask *task = pool->head;
+		pool->head = task->next;
+		if (pool->head == NULL) {
+			pool->tail = NULL;
+		}
+		pthread_mutex_unlock(&pool->lock);
+		task->fn(task->args);
+		free(task);
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->pending == 0) {
+			pthread_cond_broadcast(&pool->idle);
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+ThreadPool* MakeThreadPool(size_t nthreads) {
+	assert(nthreads >= 1);
+	ThreadPool *pool = (ThreadPool*)calloc(1, sizeof(ThreadPool));
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->notify, NULL);
+	pthread_cond_init(&pool->idle, NULL);
+	pool->threads = (pthread_t*)calloc(nthreads, sizeof(pthread_t));
+	for (size_t i = 0; i < nthreads; ++i) {
+		if (pthread_create(&pool->threads[i], NULL, TPWorker, pool) != 0) break;
+		++pool->nthreads;
+	}
+	return pool;
+}
+
+//! ڼύ
+void TPSubmit(ThreadPool *pool, TPTaskFn *fn, void *args) {
+	if (pool == NULL || pool->nthreads == 0) {
+		fn(args);
+		return;
+	}
+	TPTask *task = (TPTask*)calloc(1, sizeof(TPTask));
+	task->fn = fn;
+	task->args = args;
+	pthread_mutex_lock(&pool->lock);
+	if (pool->tail != NULL) {
+		pool->tail->next = task;
+	} else {
+		pool->head = task;
+	}
+	pool->tail = task;
+	++pool->pending;
+	pthread_cond_signal(&pool->notify);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void TPWait(ThreadPool *pool) {
+	if (pool == NULL) return;
+	pthread_mutex_lock(&pool->lock);
+	while (pool->pending > 0) {
+		pthread_cond_wait(&pool->idle, &pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void TPDestroy(ThreadPool *pool) {
+	if (pool == NULL) return;
+	pthread_mutex_lock(&pool->lock);
+	pool->shutdown = true;
+	pthread_cond_broadcast(&pool->notify);
+	pthread_mutex_unlock(&pool->lock);
+	for (size_t i = 0; i < pool->nthreads; ++i) {
+		pthread_join(pool->threads[i], NULL);
+	}
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->notify);
+	pthread_cond_destroy(&pool->idle);
+	free(pool->threads);
+	free(pool);
+}
+
+/// ɨ
+//! ¼հmorselз̴ֵ̣߳߳ʣȡ룻߳ɨ裬
+//! ֻȴȫmorselɶȴ˳ʿ̳߳е
+#define SCAN_MORSEL 1024
+
+static void ScanRelease(ScanJob *job) {
+	pthread_mutex_lock(&job->lock);
+	bool last = --job->refs == 0;
+	pthread_mutex_unlock(&job->lock);
+	if (!last) return;
+	for (size_t i = 0; i < job->nlanes; ++i) {
+		pthread_mutex_destroy(&job->lanes[i].lock);
+	}
+	pthread_mutex_destroy(&job->lock);
+	pthread_cond_destroy(&job->finish);
+	free(job->lanes);
+	free(job->morsels);
+	free(job);
+}
+
+//! ȡһmorsel߳ľʱȡȫϷSIZE_MAX
+static size_t ScanClaim(ScanJob *job, size_t lane) {
+	ScanLane *own = &job->lanes[lane];
+	while (true) {
+		pthread_mutex_lock(&own->lock);
+		if (own->next < own->end) {
+			size_t m = own->next++;
+			pthread_mutex_unlock(&own->lock);
+			return m;
+		}
+		pthread_mutex_unlock(&own->lock);
+		size_t victim = job->nlanes, most = 0;
+		for (size_t i = 0; i < job->nlanes; ++i) {
+			ScanLane *other = &job->lanes[i];
+			pthread_mutex_lock(&other->lock);
+			size_t left = other->end - other->next;
+			pthread_mutex_unlock(&other->lock);
+			if (left > most) {
+				most = left;
+				victim = i;
+			}
+		}
+		if (victim == job->nlanes) return SIZE_MAX;
+		ScanLane *other = &job->lanes[victim];
+		pthread_mutex_lock(&other->lock);
+		size_t count = (other->end - other->next + 1) / 2;
+		size_t begin = other->end - count;
+		other->end = begin;
+		pthread_mutex_unlock(&other->lock);
+		if (count == 0) continue;
+		pthread_mutex_lock(&own->lock);
+		own->next = begin;
+		own->end = begin + count;
+		pthread_mutex_unlock(&own->lock);
+	}
+}
+
+static void ScanFinish(ScanJob *job, size_t m) {
+	pthread_mutex_lock(&job->lock);
+	job->morsels[m].finished = true;
+	if (job->limit > 0 && job->morsels[m].num >= job->limit && m < job->bound) {
+		__atomic_store_n(&job->bound, m, __ATOMIC_RELAXED);
+	}
+	while (job->frontier < job->nmorsels && job->morsels[job->frontier].finished) {
+		job->found += job->morsels[job->frontier].num;
+		if (job->limit > 0 && job->found >= job->limit && job->frontier < job->bound) {
+			__atomic_store_n(&job->bound, job->frontier, __ATOMIC_RELAXED);
+		}
+		++job->frontier;
+	}
+	if (++job->done == job->nmorsels) pthread_cond_broadcast(&job->finish);
+	pthread_mutex_unlock(&job->lock);
+}
+
+static void ScanWork(ScanJob *job, size_t lane) {
+	size_t m;
+	while ((m = ScanClaim(job, lane)) != SIZE_MAX) {
+		ScanMorsel *morsel = &job->morsels[m];
+		//! ʱȫmorselɸѡʱԽboundmorselӰǰlimitֱ
+		if (job->visit != NULL) {
+			size_t begin = m * SCAN_MORSEL;
+			size_t end = begin + SCAN_MORSEL < job->nrecords ? begin + SCAN_MORSEL : job->nrecords;
+			for (size_t i = begin; i < end; ++i) {
+				job->visit(job->records[i], job->args);
+			}
+		} else if (m <= __atomic_load_n(&job->bound, __ATOMIC_RELAXED)) {
+			size_t begin = m * SCAN_MORSEL;
+			size_t end = begin + SCAN_MORSEL < job->nrecords ? begin + SCAN_MORSEL : job->nrecords;
+			size_t capacity = 0;
+			for (size_t i = begin; i < end; ++i) {
+				if (!job->match(job->records[i], job->args)) continue;
+				if (morsel->num == capacity) {
+					capacity = capacity ? capacity * 2 : 16;
+					morsel->matches = (void**)realloc(morsel->matches, capacity * sizeof(void*));
+				}
+				morsel->matches[morsel->num++] = job->records[i];
+				if (job->limit > 0 && morsel->num >= job->limit) break;
+			}
+		}
+		ScanFinish(job, m);
+	}
+}
+
+static void ScanTask(ScanJob *job) {
+	pthread_mutex_lock(&job->lock);
+	size_t lane = job->next_lane++;
+	pthread_mutex_unlock(&job->lock);
+	ScanWork(job, lane);
+	ScanRelease(job);
+}
+
+static ScanJob* MakeScanJob(ThreadPool *pool, void **records, size_t nrecords) {
+	ScanJob *job = (ScanJob*)calloc(1, sizeof(ScanJob));
+	job->records = records;
+	job->nrecords = nrecords;
+	job->nmorsels = (nrecords + SCAN_MORSEL - 1) / SCAN_MORSEL;
+	job->morsels = (ScanMorsel*)calloc(job->nmorsels ? job->nmorsels : 1, sizeof(ScanMorsel));
+	job->bound = SIZE_MAX;
+	size_t nthreads = pool != NULL ? pool->nthreads : 0;
+	job->nlanes = nthreads + 1 < job->nmorsels ? nthreads + 1 : (job->nmorsels ? job->nmorsels : 1);
+	job->lanes = (ScanLane*)calloc(job->nlanes, sizeof(ScanLane));
+	for (size_t i = 0; i < job->nlanes; ++i) {
+		pthread_mutex_init(&job->lanes[i].lock, NULL);
+		job->lanes[i].next = job->nmorsels * i / job->nlanes;
+		job->lanes[i].end = job->nmorsels * (i + 1) / job->nlanes;
+	}
+	pthread_mutex_init(&job->lock, NULL);
+	pthread_cond_init(&job->finish, NULL);
+	job->next_lane = 1;
+	job->refs = job->nlanes;
+	return job;
+}
+
+//! ߳ͬȫmorsel
+static void ScanRun(ThreadPool *pool, ScanJob *job) {
+	for (size_t i = 1; i < job->nlanes; ++i) {
+		TPSubmit(pool, (TPTaskFn*)ScanTask, job);
+	}
+	ScanWork(job, 0);
+	pthread_mutex_lock(&job->lock);
+	while (job->done < job->nmorsels) {
+		pthread_cond_wait(&job->finish, &job->lock);
+	}
+	pthread_mutex_unlock(&job->lock);
+}
+
+//! ɸѡrecordsmatchļ¼ԭ˳limit0ʱֻǰlimitǰ
+//! matchɲãɵͷ
+void** ParallelScan(ThreadPool *pool, void **records, size_t nrecords, TLMatchFn match, void *args,
+	size_t limit, size_t *num) {
+	ScanJob *job = MakeScanJob(pool, records, nrecords);
+	job->match = match;
+	job->args = args;
+	job->limit = limit;
+	ScanRun(pool, job);
+
+	size_t count = 0;
+	for (size_t m = 0; m < job->nmorsels && m <= job->bound; ++m) {
+		count += job->morsels[m].num;
+	}
+	if (limit > 0 && count > limit) count = limit;
+	void **results = (void**)malloc((count ? count : 1) * sizeof(void*));
+	size_t n = 0;
+	for (size_t m = 0; m < job->nmorsels; ++m) {
+		ScanMorsel *morsel = &job->morsels[m];
+		for (size_t i = 0; i < morsel->num && n < count; ++i) {
+			results[n++] = morsel->matches[i];
+		}
+		free(morsel->matches);
+	}
+	*num = count;
+	ScanRelease(job);
+	return (void**)results;
+}
+
+//! жÿ¼visitռvisitɲ
+void ParallelForEach(ThreadPool *pool, void **records, size_t nrecords, TLVisitFn visit, void *args) {
+	ScanJob *job = MakeScanJob(pool, records, nrecords);
+	job->visit = visit;
+	job->args = args;
+	ScanRun(pool, job);
+	ScanRelease(job);
+}
+
+//! Ĳɸѡ
+void** TLParallelScan(TList *list, ThreadPool *pool, TLMatchFn match, void *args, size_t limit, size_t *num) {
+	size_t nrecords = 0;
+	void **records = TLSnapshot(list, &nrecords);
+	void **results = ParallelScan(pool, records, nrecords, match, args, limit, num);
+	free(records);
+	return results;
+}
+
+//! TLMatchĲа汾˳ϵһƥĽڵ
+void* TLParallelMatch(TList *list, ThreadPool *pool, TLMatchFn match, void *args) {
+	size_t num = 0;
+	void **results = TLParallelScan(list, pool, match, args, 1, &num);
+	void *data = num > 0 ? results[0] : NULL;
+	free(results);
+	return data;
+}
+
+/// ʱ亯
+//! ߳ͬȡʱ䣬ÿ汾
+void TimeToTimestamp(Timestamp *stamp, time_t tm) {
+	struct tm detail;
+#ifdef _WIN32
+	localtime_s(&detail, &tm);
+#else
+	localtime_r(&tm, &detail);
+#endif
+	stamp->year = detail.tm_year + 1900;
+	stamp->month = detail.tm_mon + 1;
+	stamp->day = detail.tm_mday;
+	stamp->weekday = detail.tm_wday + 1;
+	stamp->hour = detail.tm_hour;
+	stamp->min = detail.tm_min;
+	stamp->sec = detail.tm_sec;
+}
+
+void GetTimestamp(Timestamp *stamp) {
+	assert(stamp != NULL);
+	time_t rawtime;
+	time(&rawtime);
+	TimeToTimestamp(stamp, rawtime);
+}
+
+//! "YYYY-MM-DD[ HH:MM[:SS]]"ʽıʱ
+bool ParseTimestamp(const char *text, Timestamp *stamp) {
+	struct tm detail = { };
+	int n = sscanf(text, "%d-%d-%d %d:%d:%d", &detail.tm_year, &detail.tm_mon, &detail.tm_mday,
+		&detail.tm_hour, &detail.tm_min, &detail.tm_sec);
+	if (n != 3 && n < 5) return false;
+	detail.tm_year -= 1900;
+	detail.tm_mon -= 1;
+	detail.tm_isdst = -1;
+	time_t tm = mktime(&detail);
+	if (tm == (time_t)-1) return false;
+	TimeToTimestamp(stamp, tm);
+	return true;
+}
+
+//! 1970-01-01ʱ޹
+int32_t GetDayNumber(const Timestamp *stamp) {
+	int y = stamp->year - (stamp->month <= 2);
+	int era = (y >= 0 ? y : y - 399) / 400;
+	int yoe = y - era * 400;
+	int doy = (153 * (stamp->month + (stamp->month > 2 ? -3 : 9)) + 2) / 5 + stamp->day - 1;
+	int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + doe - 719468;
+}
+
+//! ʱ΢ڼʱ
+int64_t GetMicroseconds() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+double GetDuration(Timestamp *begin, Timestamp *end) {
+	assert(begin != NULL);
+	assert(end != NULL);
+
+	time_t tm_begin, tm_end;
+	struct tm detail = { };
+	detail.tm_isdst = -1;
+
+	detail.tm_year = begin->year - 1900;
+	detail.tm_mon = begin->month - 1;
+	detail.tm_mday = begin->day;
+	detail.tm_wday = begin->weekday - 1;
+	detail.tm_hour = begin->hour;
+	detail.tm_min = begin->min;
+	detail.tm_sec = begin->sec;
+	tm_begin = mktime(&detail);
+
+	detail.tm_year = end->year - 1900;
+	detail.tm_mon = end->month - 1;
+	detail.tm_mday = end->day;
+	detail.tm_wday = end->weekday - 1;
+	detail.tm_hour = end->hour;
+	detail.tm_min = end->min;
+	detail.tm_sec = end->sec;
+	tm_end = mktime(&detail);
+
+	return difftime(tm_end, tm_begin);
+}
+
+/// Ȩ޹
+bool RequireService(enum UserGroup identity, enum Permission service) {
+	enum Permission access[] = {
+		[User] UserAccess, [Manager] ManagerAccess, [Admin] AdminAccess
+	};
+	return !!(access[identity] & service);
+}
+
+bool CheckAccess(enum UserGroup identity, enum Permission op) {
+	enum Permission access[] = {
+		[User] UserAccess, [Manager] ManagerAccess, [Admin] AdminAccess
+	};
+	return (access[identity] & op) == op;
+}
+
+/// ISBN
+//! ϷISBNͳһΪ13λּ޷УľλǵĹϣ
+#define ISBN_LEGACY (1ull << 63)
+
+//! ȥַհףͳһУλXΪд
+size_t NormalizeISBN(const char *ISBN, char *out, size_t size) {
+	size_t len = 0;
+	for (; *ISBN != '\0' && len + 1 < size; ++ISBN) {
+		if (*ISBN == '-' || isspace((uint8_t)*ISBN)) continue;
+		out[len++] = toupper((uint8_t)*ISBN);
+	}
+	out[len] = '\0';
+	return len;
+}
+
+//! ISBN-10ISBN-13Уʧܷ0
+uint64_t ParseISBN(const char *ISBN) {
+	char digits[32];
+	size_t len = NormalizeISBN(ISBN, digits, sizeof(digits));
+	uint64_t key = 0;
+	if (len == 10) {
+		int sum = 0;
+		//! ǰ9λΪ֣УλΪX
+		for (int i = 0; i < 10; ++i) {
+			int d = 0;
+			if (isdigit((uint8_t)digits[i])) {
+				d = digits[i] - '0';
+			} else if (i == 9 && digits[i] == 'X') {
+				d = 10;
+			} else {
+				return 0;
+			}
+			sum += d * (10 - i);
+		}
+		if (sum % 11 != 0) return 0;
+		key = 978;
+		sum = 9 + 3 * 7 + 8;
+		for (int i = 0; i < 9; ++i) {
+			key = key * 10 + (digits[i] - '0');
+			sum += (digits[i] - '0') * (i % 2 == 0 ? 3 : 1);
+		}
+		return key * 10 + (10 - sum % 10) % 10;
+	} else if (len == 13) {
+		int sum = 0;
+		for (int i = 0; i < 13; ++i) {
+			if (!isdigit((uint8_t)digits[i])) return 0;
+			sum += (digits[i] - '0') * (i % 2 == 0 ? 1 : 3);
+			key = key * 10 + (digits[i] - '0');
+		}
+		if (sum % 10 != 0 || (key / 10000000000ull != 978 && key / 10000000000ull != 979)) return 0;
+		return key;
+	}
+	return 0;
+}
+
+//! Ѵ洢ISBNתΪ޷Уľ
+uint64_t ISBNKey(const char *ISBN) {
+	uint64_t key = ParseISBN(ISBN);
+	if (key != 0) return key;
+	char digits[32];
+	NormalizeISBN(ISBN, digits, sizeof(digits));
+	return ISBN_LEGACY | hash64(digits);
+}
+
+//! ɢֵڹϣ
+static inline uint64_t ISBNHash64(uint64_t key) {
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdull;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ull;
+	return key ^ (key >> 33);
+}
+
+static inline uint32_t ISBNHash(uint64_t key) {
+	return (uint32_t)(ISBNHash64(key) >> 32);
+}
+
+void FormatISBN(uint64_t key, char *out, size_t size) {
+	if (key & ISBN_LEGACY) {
+		snprintf(out, size, "-");
+	} else {
+		snprintf(out, size, "%013llu", (unsigned long long)key);
+	}
+}
+
+/// ֽڻ
+void BBReserve(ByteBuffer *buffer, size_t size) {
+	if (buffer->size + size <= buffer->capacity) return;
+	size_t capacity = buffer->capacity > 0 ? buffer->capacity : 256;
+	while (capacity < buffer->size + size) {
+		capacity <<= 1;
+	}
+	buffer->data = (uint8_t*)realloc(buffer->data, capacity);
+	buffer->capacity = capacity;
+}
+
+void BBWrite(ByteBuffer *buffer, const void *data, size_t size) {
+	BBReserve(buffer, size);
+	memcpy(buffer->data + buffer->size, data, size);
+	buffer->size += size;
+}
+
+void BBPutVarint(ByteBuffer *buffer, uint64_t value) {
+	BBReserve(buffer, 10);
+	while (value >= 0x80) {
+		buffer->data[buffer->size++] = (uint8_t)value | 0x80;
+		value >>= 7;
+	}
+	buffer->data[buffer->size++] = (uint8_t)value;
+}
+
+void BBFree(ByteBuffer *buffer) {
+	free(buffer->data);
+	memset(buffer, 0, sizeof(ByteBuffer));
+}
+
+bool ReadVarint(FILE *fp, uint64_t *value) {
+	*value = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		int c = getc(fp);
+		if (c == EOF) return false;
+		*value |= (uint64_t)(c & 0x7f) << shift;
+		if (!(c & 0x80)) return true;
+	}
+	return false;
+}
+
+static inline uint64_t ZigZag(int64_t value) {
+	return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t UnZigZag(uint64_t value) {
+	return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+uint64_t PackTimestamp(const Timestamp *tm) {
+	if (tm->year < 0) return 0;
+	return (uint64_t)tm->year << 29 | (uint64_t)tm->month << 25 | (uint64_t)tm->day << 20
+		| (uint64_t)tm->hour << 15 | (uint64_t)tm->min << 9 | (uint64_t)tm->sec << 3 | tm->weekday;
+}
+
+void UnpackTimestamp(Timestamp *tm, uint64_t packed) {
+	if (packed == 0) {
+		memset(tm, 0, sizeof(Timestamp));
+		tm->year = -1;
+		return;
+	}
+	tm->year = packed >> 29;
+	tm->month = (packed >> 25) & 0xf;
+	tm->day = (packed >> 20) & 0x1f;
+	tm->hour = (packed >> 15) & 0x1f;
+	tm->min = (packed >> 9) & 0x3f;
+	tm->sec = (packed >> 3) & 0x3f;
+	tm->weekday = packed & 0x7;
+}
+
+/// У
+//! հCRC32CУβϢļĩβ
+#define DB_BLOCK_SIZE (64 << 10)
+#define CHECKSUM_MAGIC 0x4d534b43
+
+static uint32_t CRC32CTable[8][256];
+static pthread_once_t CRC32COnce = PTHREAD_ONCE_INIT;
+static bool CRC32CHardware;
+
+static void CRC32CInit() {
+	for (uint32_t n = 0; n < 256; ++n) {
+		uint32_t crc = n;
+		for (int k = 0; k < 8; ++k) {
+			crc = crc & 1 ? (crc >> 1) ^ 0x82f63b78 : crc >> 1;
+		}
+		CRC32CTable[0][n] = crc;
+	}
+	for (uint32_t n = 0; n < 256; ++n) {
+		for (int k = 1; k < 8; ++k) {
+			uint32_t prev = CRC32CTable[k - 1][n];
+			CRC32CTable[k][n] = (prev >> 8) ^ CRC32CTable[0][prev & 0xff];
+		}
+	}
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	CRC32CHardware = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+//! ˱ÿδ8ֽ
+static uint32_t CRC32CSoftware(uint32_t crc, const uint8_t *p, size_t size) {
+	for (; size > 0 && ((uintptr_t)p & 7) != 0; --size) {
+		crc = (crc >> 8) ^ CRC32CTable[0][(crc ^ *p++) & 0xff];
+	}
+	for (; size >= 8; size -= 8, p += 8) {
+		uint32_t lo, hi;
+		memcpy(&lo, p, 4);
+		memcpy(&hi, p + 4, 4);
+		lo ^= crc;
+		crc = CRC32CTable[7][lo & 0xff] ^ CRC32CTable[6][(lo >> 8) & 0xff]
+			^ CRC32CTable[5][(lo >> 16) & 0xff] ^ CRC32CTable[4][lo >> 24]
+			^ CRC32CTable[3][hi & 0xff] ^ CRC32CTable[2][(hi >> 8) & 0xff]
+			^ CRC32CTable[1][(hi >> 16) & 0xff] ^ CRC32CTable[0][hi >> 24];
+	}
+	while (size-- > 0) {
+		crc = (crc >> 8) ^ CRC32CTable[0][(crc ^ *p++) & 0xff];
+	}
+	return crc;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <nmmintrin.h>
+__attribute__((target("sse4.2")))
+static uint32_t CRC32CSSE42(uint32_t crc, const uint8_t *p, size_t size) {
+	for (; size > 0 && ((uintptr_t)p & 7) != 0; --size) {
+		crc = _mm_crc32_u8(crc, *p++);
+	}
+#ifdef __x86_64__
+	uint64_t crc64 = crc;
+	for (; size >= 8; size -= 8, p += 8) {
+		uint64_t word;
+		memcpy(&word, p, 8);
+		crc64 = _mm_crc32_u64(crc64, word);
+	}
+	crc = (uint32_t)crc64;
+#endif
+	for (; size >= 4; size -= 4, p += 4) {
+		uint32_t word;
+		memcpy(&word, p, 4);
+		crc = _mm_crc32_u32(crc, word);
+	}
+	while (size-- > 0) {
+		crc = _mm_crc32_u8(crc, *p++);
+	}
+	return crc;
+}
+#endif
+
+//! ֧SSE4.2ʱʹcrc32ָ
+uint32_t CRC32C(const void *data, size_t size) {
+	pthread_once(&CRC32COnce, CRC32CInit);
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	if (CRC32CHardware) return ~CRC32CSSE42(~0u, (const uint8_t*)data, size);
+#endif
+	return ~CRC32CSoftware(~0u, (const uint8_t*)data, size);
+}
+
+//! ΪimageУ鲢׷УβϢ
+void AppendChecksums(ByteBuffer *image) {
+	ChecksumInfo info = { image->size, DB_BLOCK_SIZE, 0, 0, CHECKSUM_MAGIC };
+	info.nblocks = (image->size + DB_BLOCK_SIZE - 1) / DB_BLOCK_SIZE;
+	uint32_t *table = (uint32_t*)malloc((info.nblocks + 1) * sizeof(uint32_t));
+	for (uint32_t n = 0; n < info.nblocks; ++n) {
+		size_t offset = (size_t)n * DB_BLOCK_SIZE;
+		size_t len = image->size - offset < DB_BLOCK_SIZE ? image->size - offset : DB_BLOCK_SIZE;
+		table[n] = CRC32C(image->data + offset, len);
+	}
+	info.table_crc = CRC32C(table, info.nblocks * sizeof(uint32_t));
+	BBWrite(image, table, info.nblocks * sizeof(uint32_t));
+	BBWrite(image, &info, sizeof(ChecksumInfo));
+	free(table);
+}
+
+//! ȡУļĩβУʧʱNULL
+uint32_t* ReadChecksums(const char *path, ChecksumInfo *info) {
+	int fd = open(path, O_RDONLY | O_BINARY);
+	if (fd < 0) return NULL;
+	int64_t size = lseek(fd, 0, SEEK_END);
+	uint32_t *table = NULL;
+	if (size >= (int64_t)sizeof(ChecksumInfo)
+		&& ReadAt(fd, info, sizeof(ChecksumInfo), size - sizeof(ChecksumInfo))
+		&& info->magic == CHECKSUM_MAGIC && info->block_size > 0
+		&& info->nblocks == (info->data_size + info->block_size - 1) / info->block_size
+		&& info->data_size + info->nblocks * sizeof(uint32_t) + sizeof(ChecksumInfo) == (uint64_t)size) {
+		table = (uint32_t*)malloc((info->nblocks + 1) * sizeof(uint32_t));
+		if (!ReadAt(fd, table, info->nblocks * sizeof(uint32_t), info->data_size)
+			|| CRC32C(table, info->nblocks * sizeof(uint32_t)) != info->table_crc) {
+			free(table);
+			table = NULL;
+		}
+	}
+	close(fd);
+	return table;
+}
+
+//! У[begin, end)ΧĿ飬¼𻵿׸𻵿
+void VerifyBlocks(VerifyPart *part) {
+	const ChecksumInfo *info = part->info;
+	int fd = open(part->path, O_RDONLY | O_BINARY);
+	uint8_t *block = (uint8_t*)malloc(info->block_size);
+	for (uint32_t n = part->begin; n < part->end; ++n) {
+		uint64_t offset = (uint64_t)n * info->block_size;
+		size_t len = info->data_size - offset < info->block_size ? info->data_size - offset : info->block_size;
+		if (fd < 0 || !ReadAt(fd, block, len, offset) || CRC32C(block, len) != part->table[n]) {
+			if (part->nbad++ == 0) part->first_bad = n;
+		}
+	}
+	free(block);
+	if (fd >= 0) close(fd);
+}
+
+//! ȫΪnparts
+void SplitVerifyParts(VerifyPart *parts, size_t nparts, const char *path, const ChecksumInfo *info, const uint32_t *table) {
+	for (size_t i = 0; i < nparts; ++i) {
+		VerifyPart part = { path, info, table };
+		part.begin = info->nblocks * i / nparts;
+		part.end = info->nblocks * (i + 1) / nparts;
+		parts[i] = part;
+	}
+}
+
+//! У鵥ļ𻵿ŽǰļĿ
+static bool ScrubFile(const char *path, uint32_t *nblocks, VerifyPart *damaged) {
+	ChecksumInfo info = { };
+	uint32_t *table = ReadChecksums(path, &info);
+	size_t nparts = GetProcessorNum();
+	if (nparts > info.nblocks) nparts = info.nblocks;
+	if (table != NULL && nparts > 0) {
+		VerifyPart *parts = (VerifyPart*)calloc(nparts, sizeof(VerifyPart));
+		ThreadPool *pool = MakeThreadPool(nparts);
+		SplitVerifyParts(parts, nparts, path, &info, table);
+		for (size_t i = 0; i < nparts; ++i) {
+			TPSubmit(pool, (TPTaskFn*)VerifyBlocks, &parts[i]);
+		}
+		TPWait(pool);
+		TPDestroy(pool);
+		for (size_t i = 0; i < nparts; ++i) {
+			if (damaged->nbad == 0) damaged->first_bad = *nblocks + parts[i].first_bad;
+			damaged->nbad += parts[i].nbad;
+		}
+		free(parts);
+	}
+	free(table);
+	*nblocks += info.nblocks;
+	return table != NULL;
+}
+
+//! У嵥õĸƬļ
+static void* ScrubWorker(void *args) {
+	ScrubJob *job = (ScrubJob*)args;
+	struct timespec begin, end;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	VerifyPart damaged = { };
+	uint32_t nblocks = 0;
+	bool readable = ScrubFile(job->path, &nblocks, &damaged);
+	DBManifest manifest = { };
+	uint64_t generations[DB_MAX_SHARDS] = { };
+	FILE *fp = fopen(job->path, "rb");
+	if (fp != NULL) {
+		if (fread(&manifest, sizeof(DBManifest), 1, fp) != 1 || manifest.header.version < 6
+			|| manifest.nshards > DB_MAX_SHARDS
+			|| fread(generations, sizeof(uint64_t), manifest.nshards, fp) != manifest.nshards) {
+			manifest.nshards = 0;
+		}
+		fclose(fp);
+	}
+	for (uint32_t k = 0; k < manifest.nshards; ++k) {
+		char path[512];
+		snprintf(path, sizeof(path), "%s.%u.%llu", job->path, k, (unsigned long long)generations[k]);
+		readable = ScrubFile(path, &nblocks, &damaged) && readable;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	pthread_mutex_lock(&job->lock);
+	job->readable = readable;
+	job->nblocks = nblocks;
+	job->nbad = damaged.nbad;
+	job->first_bad = damaged.first_bad;
+	job->seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) * 1e-9;
+	GetTimestamp(&job->tm_finish);
+	job->running = false;
+	pthread_mutex_unlock(&job->lock);
+	return NULL;
+}
+
+ScrubJob* MakeScrubJob(const char *path) {
+	ScrubJob *job = (ScrubJob*)calloc(1, sizeof(ScrubJob));
+	job->path = strdup(path);
+	pthread_mutex_init(&job->lock, NULL);
+	return job;
+}
+
+//! ̨Уϵ㣬ʱfalse
+bool StartScrub(ScrubJob *job) {
+	pthread_mutex_lock(&job->lock);
+	if (job->running) {
+		pthread_mutex_unlock(&job->lock);
+		return false;
+	}
+	if (job->started) pthread_join(job->thread, NULL);
+	job->started = job->running = true;
+	pthread_mutex_unlock(&job->lock);
+	pthread_create(&job->thread, NULL, ScrubWorker, job);
+	return true;
+}
+
+void ScrubDestroy(ScrubJob *job) {
+	if (!job) return;
+	if (job->started) pthread_join(job->thread, NULL);
+	pthread_mutex_destroy(&job->lock);
+	free(job->path);
+	free(job);
+}
+
+/// ַ
+//! 0Ϊմַַڳصڲ
+#define SP_NONE UINT32_MAX
+#define SP_CHUNK_SIZE 65536
+
+//! ASCII۵ΪСдGBKȫַתǣȥհףؼ
+size_t NormalizeText(const char *text, char *out, size_t size) {
+	size_t len = 0, left = strlen(text);
+	while (left > 0 && len + 1 < size) {
+		size_t step = GBKCharLen(text, left);
+		uint8_t c = (uint8_t)text[0];
+		if (step == 2 && c == 0xa3 && (uint8_t)text[1] >= 0xa1) {
+			// row 0xA3 mirrors printable ASCII in full width
+			c = (uint8_t)text[1] - 0x80;
+		} else if (step == 2 && c == 0xa1) {
+			// row 0xA1 holds the ideographic space and CJK punctuation
+			c = ' ';
+		}
+		if (c < 0x80) {
+			if (!isspace(c) && !ispunct(c)) out[len++] = tolower(c);
+		} else {
+			if (len + step >= size) break;
+			memcpy(out + len, text, step);
+			len += step;
+		}
+		text += step;
+		left -= step;
+	}
+	out[len] = '\0';
+	return len;
+}
+
+//! ģʽǿʱڼƥ䣬紿㣩ԭƥ
+bool TextContains(const char *text, const char *key, const char *pattern) {
+	char needle[256];
+	if (NormalizeText(pattern, needle, sizeof(needle)) == 0) return strstr(text, pattern) != NULL;
+	return strstr(key, needle) != NULL;
+}
+
+//! ģʽĹʽΪʱԭ
+const char* SearchKey(const char *pattern, char *buf, size_t size) {
+	return NormalizeText(pattern, buf, size) > 0 ? buf : pattern;
+}
+
+StringPool* MakeStringPool() {
+	StringPool *pool = (StringPool*)calloc(1, sizeof(StringPool));
+	pool->capacity = 64;
+	pool->strings = (char**)calloc(pool->capacity, sizeof(char*));
+	pool->keys = (char**)calloc(pool->capacity, sizeof(char*));
+	pool->keys[pool->count] = "";
+	pool->strings[pool->count++] = "";
+	pool->lookup = MakeHashIndex(0);
+	pool->chunks = MakeTList(sizeof(char*));
+	return pool;
+}
+
+void SPDestroy(StringPool *pool) {
+	if (!pool) return;
+	for (TListNode *p = pool->chunks->head; p != NULL; p = p->next) {
+		free(*(char**)p->data);
+	}
+	TLDestroy(pool->chunks);
+	free(pool->chunks);
+	HIDestroy(pool->lookup);
+	free(pool->strings);
+	free(pool->keys);
+	free(pool);
+}
+
+static inline const char* SPGet(StringPool *pool, uint32_t handle) {
+	return handle < pool->count ? pool->strings[handle] : "";
+}
+
+static inline const char* SPKey(StringPool *pool, uint32_t handle) {
+	return handle < pool->count ? pool->keys[handle] : "";
+}
+
+static bool SPMatch(void *ref, void *args) {
+	return strcmp(*(char**)args, ((StringPool**)args)[1]->strings[(uintptr_t)ref]) == 0;
+}
+
+//! δʱSP_NONE
+uint32_t SPLookup(StringPool *pool, const char *str) {
+	if (*str == '\0') return 0;
+	void *args[2] = { (void*)str, pool };
+	void *ref = HIMatch(pool->lookup, hash(str), SPMatch, args);
+	return ref != NULL ? (uint32_t)(uintptr_t)ref : SP_NONE;
+}
+
+static char* SPAlloc(StringPool *pool, size_t size) {
+	if (size > pool->arena_left) {
+		size_t chunk_size = size > SP_CHUNK_SIZE ? size : SP_CHUNK_SIZE;
+		pool->arena = (char*)malloc(chunk_size);
+		pool->arena_left = chunk_size;
+		TLAppend(pool->chunks, &pool->arena);
+	}
+	char *p = pool->arena;
+	pool->arena += size;
+	pool->arena_left -= size;
+	return p;
+}
+
+//! ˻һηĩβδõֽ
+static void SPShrink(StringPool *pool, size_t unused) {
+	pool->arena -= unused;
+	pool->arena_left += unused;
+}
+
+uint32_t SPIntern(StringPool *pool, const char *str) {
+	uint32_t handle = SPLookup(pool, str);
+	if (handle != SP_NONE) return handle;
+	if (pool->count == pool->capacity) {
+		pool->capacity *= 2;
+		pool->strings = (char**)realloc(pool->strings, pool->capacity * sizeof(char*));
+		pool->keys = (char**)realloc(pool->keys, pool->capacity * sizeof(char*));
+	}
+	size_t size = strlen(str) + 1;
+	char *p = SPAlloc(pool, size);
+	memcpy(p, str, size);
+	pool->bytes += size;
+	//! ԭģ͵д˻ಿ
+	char *key = SPAlloc(pool, size);
+	size_t len = NormalizeText(p, key, size);
+	if (strcmp(key, p) == 0) {
+		SPShrink(pool, size);
+		key = p;
+	} else {
+		SPShrink(pool, size - len - 1);
+	}
+	handle = pool->count++;
+	pool->strings[handle] = p;
+	pool->keys[handle] = key;
+	HIInsert(pool->lookup, hash(p), (void*)(uintptr_t)handle);
+	return handle;
+}
+
+//! ǼpatternȫַÿַֻͬȽһ
+uint8_t* SPMatchAll(StringPool *pool, const char *pattern) {
+	char needle[256];
+	bool folded = NormalizeText(pattern, needle, sizeof(needle)) > 0;
+	char **texts = folded ? pool->keys : pool->strings;
+	if (folded) pattern = needle;
+	uint8_t *matched = (uint8_t*)calloc(pool->count, sizeof(uint8_t));
+	for (uint32_t n = 0; n < pool->count; ++n) {
+		matched[n] = strstr(texts[n], pattern) != NULL;
+	}
+	return matched;
+}
+
+//! 洢ʽuint32Ŀuint32ֽ˳'\0'ַָ
+bool ReadStringPool(StringPool *pool, const char *data, size_t size, uint32_t count) {
+	const char *end = data + size;
+	for (uint32_t n = 1; n < count; ++n) {
+		size_t length = strnlen(data, end - data);
+		if (data + length >= end) return false;
+		if (SPIntern(pool, data) != n) return false;
+		data += length + 1;
+	}
+	return true;
+}
+
+void WriteStringPool(StringPool *pool, ByteBuffer *buffer) {
+	uint32_t info[2] = { pool->count, (uint32_t)pool->bytes };
+	BBWrite(buffer, info, sizeof(info));
+	for (uint32_t n = 1; n < info[0]; ++n) {
+		BBWrite(buffer, pool->strings[n], strlen(pool->strings[n]) + 1);
+	}
+}
+
+/// ȶͳ
+//! ÿһSpace-SavingժҪڲѯʱϲ
+HeavyHitters* MakeHeavyHitters() {
+	HeavyHitters *hitters = (HeavyHitters*)calloc(1, sizeof(HeavyHitters));
+	for (int i = 0; i < HH_WINDOW_NUM; ++i) {
+		hitters->windows[i].day = INT32_MIN;
+	}
+	return hitters;
+}
+
+void HHRecord(HeavyHitters *hitters, uint64_t isbn, int32_t day) {
+	if (!hitters) return;
+	HitWindow *window = &hitters->windows[(uint32_t)day % HH_WINDOW_NUM];
+	if (window->day != day) {
+		if (window->day > day) return;
+		window->day = day;
+		window->size = 0;
+	}
+	HitCounter *least = NULL;
+	for (uint32_t i = 0; i < window->size; ++i) {
+		HitCounter *counter = &window->counters[i];
+		if (counter->isbn == isbn) {
+			++counter->count;
+			return;
+		}
+		if (least == NULL || counter->count < least->count) {
+			least = counter;
+		}
+	}
+	if (window->size < HH_CAPACITY) {
+		least = &window->counters[window->size++];
+		memset(least, 0, sizeof(HitCounter));
+	} else {
+		least->error = least->count;
+	}
+	least->isbn = isbn;
+	++least->count;
+}
+
+static int CompareHitKey(const void *lhs, const void *rhs) {
+	const HitCounter *a = lhs, *b = rhs;
+	if (a->isbn != b->isbn) return a->isbn < b->isbn ? -1 : 1;
+	return 0;
+}
+
+static int CompareHitCount(const void *lhs, const void *rhs) {
+	const HitCounter *a = lhs, *b = rhs;
+	if (a->count != b->count) return a->count > b->count ? -1 : 1;
+	if (a->isbn != b->isbn) return a->isbn < b->isbn ? -1 : 1;
+	return 0;
+}
+
+//! ϲtodaydaysգǰtopkɵ÷ͷ
+HitCounter* HHTopK(HeavyHitters *hitters, int32_t today, int days, size_t topk, size_t *num) {
+	size_t total = 0;
+	HitCounter *merged = (HitCounter*)malloc(HH_WINDOW_NUM * HH_CAPACITY * sizeof(HitCounter));
+	for (int i = 0; i < HH_WINDOW_NUM && i < days; ++i) {
+		HitWindow *window = &hitters->windows[(uint32_t)(today - i) % HH_WINDOW_NUM];
+		if (window->day != today - i) continue;
+		memcpy(merged + total, window->counters, window->size * sizeof(HitCounter));
+		total += window->size;
+	}
+	qsort(merged, total, sizeof(HitCounter), CompareHitKey);
+	size_t unique = 0;
+	for (size_t i = 0; i < total; ++i) {
+		if (unique > 0 && CompareHitKey(&merged[unique - 1], &merged[i]) == 0) {
+			merged[unique - 1].count += merged[i].count;
+			merged[unique - 1].error += merged[i].error;
+		} else {
+			merged[unique++] = merged[i];
+		}
+	}
+	qsort(merged, unique, sizeof(HitCounter), CompareHitCount);
+	*num = unique < topk ? unique : topk;
+	return merged;
+}
+
+bool ReadHeavyHitters(HeavyHitters *hitters, FILE *fp) {
+	for (int i = 0; i < HH_WINDOW_NUM; ++i) {
+		HitWindow *window = &hitters->windows[i];
+		if (fread(&window->day, sizeof(int32_t), 1, fp) != 1) return false;
+		if (fread(&window->size, sizeof(uint32_t), 1, fp) != 1) return false;
+		if (window->size > HH_CAPACITY) return false;
+		if (fread(window->counters, sizeof(HitCounter), window->size, fp) != window->size) return false;
+	}
+	return true;
+}
+
+void WriteHeavyHitters(HeavyHitters *hitters, FILE *fp) {
+	for (int i = 0; i < HH_WINDOW_NUM; ++i) {
+		HitWindow *window = &hitters->windows[i];
+		fwrite(&window->day, sizeof(int32_t), 1, fp);
+		fwrite(&window->size, sizeof(uint32_t), 1, fp);
+		fwrite(window->counters, sizeof(HitCounter), window->size, fp);
+	}
+}
+
+/// ͬ
+//! ĿбţÿԶCB_TOP_NλȨߵھ
+PairTable* MakePairTable(size_t hint) {
+	PairTable *table = (PairTable*)calloc(1, sizeof(PairTable));
+	table->capacity = 64;
+	while (table->capacity < hint * 2) {
+		table->capacity <<= 1;
+	}
+	table->keys = (uint64_t*)calloc(table->capacity, sizeof(uint64_t));
+	table->counts = (uint32_t*)calloc(table->capacity, sizeof(uint32_t));
+	return table;
+}
+
+void PTDestroy(PairTable *table) {
+	if (!table) return;
+	free(table->keys);
+	free(table->counts);
+	free(table);
+}
+
+static inline uint64_t PTKey(uint32_t a, uint32_t b) {
+	return a < b ? ((uint64_t)(a + 1) << 32 | (b + 1)) : ((uint64_t)(b + 1) << 32 | (a + 1));
+}
+
+static uint32_t* PTSlot(PairTable *table, uint64_t key) {
+	if ((table->size + 1) * 2 > table->capacity) {
+		PairTable grown = { };
+		grown.capacity = table->capacity * 2;
+		grown.keys = (uint64_t*)calloc(grown.capacity, sizeof(uint64_t));
+		grown.counts = (uint32_t*)calloc(grown.capacity, sizeof(uint32_t));
+		for (size_t i = 0; i < table->capacity; ++i) {
+			if (table->keys[i] == 0) continue;
+			*PTSlot(&grown, table->keys[i]) = table->counts[i];
+		}
+		free(table->keys);
+		free(table->counts);
+		table->keys = grown.keys;
+		table->counts = grown.counts;
+		table->capacity = grown.capacity;
+	}
+	size_t slot = (key * 0x9e3779b97f4a7c15ull >> 20) & (table->capacity - 1);
+	while (table->keys[slot] != 0 && table->keys[slot] != key) {
+		slot = (slot + 1) & (table->capacity - 1);
+	}
+	if (table->keys[slot] == 0) {
+		table->keys[slot] = key;
+		++table->size;
+	}
+	return &table->counts[slot];
+}
+
+CoBorrowIndex* MakeCoBorrowIndex() {
+	CoBorrowIndex *index = (CoBorrowIndex*)calloc(1, sizeof(CoBorrowIndex));
+	index->rows = MakeHashIndex(0);
+	index->patrons = MakeHashIndex(0);
+	index->pairs = MakePairTable(0);
+	return index;
+}
+
+void CBDestroy(CoBorrowIndex *index) {
+	if (!index) return;
+	for (size_t i = 0; i < index->patrons->capacity; ++i) {
+		PatronHistory *history = index->patrons->entries[i].ref;
+		if (history == NULL || history == HI_TOMBSTONE) continue;
+		free(history->rows);
+		free(history);
+	}
+	HIDestroy(index->rows);
+	HIDestroy(index->patrons);
+	PTDestroy(index->pairs);
+	free(index->books);
+	free(index->neighbors);
+	free(index->weights);
+	free(index->degree);
+	free(index);
+}
+
+//! кżĿ״νʱõţkeyhashɵ÷
+uint32_t CBRow(CoBorrowIndex *index, void *book, uint32_t keyhash) {
+	void *ref = NULL;
+	size_t cursor = 0;
+	while ((ref = HINext(index->rows, keyhash, &cursor)) != NULL) {
+		uint32_t row = (uint32_t)(uintptr_t)ref - 1;
+		if (index->books[row] == book) return row;
+	}
+	if (index->nrows == index->capacity) {
+		index->capacity = index->capacity > 0 ? index->capacity * 2 : 64;
+		index->books = (void**)realloc(index->books, index->capacity * sizeof(void*));
+		index->neighbors = (uint32_t*)realloc(index->neighbors, index->capacity * CB_TOP_N * sizeof(uint32_t));
+		index->weights = (uint32_t*)realloc(index->weights, index->capacity * CB_TOP_N * sizeof(uint32_t));
+		index->degree = (uint8_t*)realloc(index->degree, index->capacity * sizeof(uint8_t));
+	}
+	uint32_t row = index->nrows++;
+	index->books[row] = book;
+	index->degree[row] = 0;
+	HIInsert(index->rows, keyhash, (void*)(uintptr_t)(row + 1));
+	return row;
+}
+
+//! Ȩֻھʱԭð
+static void CBOffer(CoBorrowIndex *index, uint32_t row, uint32_t neighbor, uint32_t weight) {
+	uint32_t *neighbors = index->neighbors + (size_t)row * CB_TOP_N;
+	uint32_t *weights = index->weights + (size_t)row * CB_TOP_N;
+	int i = 0, degree = index->degree[row];
+	while (i < degree && neighbors[i] != neighbor) {
+		++i;
+	}
+	if (i == degree) {
+		if (degree < CB_TOP_N) {
+			index->degree[row] = ++degree;
+		} else if (weights[degree - 1] >= weight) {
+			return;
+		} else {
+			i = degree - 1;
+		}
+	}
+	while (i > 0 && weights[i - 1] < weight) {
+		neighbors[i] = neighbors[i - 1];
+		weights[i] = weights[i - 1];
+		--i;
+	}
+	neighbors[i] = neighbor;
+	weights[i] = weight;
+}
+
+static PatronHistory* CBPatron(CoBorrowIndex *index, uint32_t borrower_id) {
+	PatronHistory *history = HIMatch(index->patrons, borrower_id, NULL, NULL);
+	if (history == NULL) {
+		history = (PatronHistory*)calloc(1, sizeof(PatronHistory));
+		HIInsert(index->patrons, borrower_id, history);
+	}
+	return history;
+}
+
+static bool PHAdd(PatronHistory *history, uint32_t row) {
+	for (uint32_t i = 0; i < history->size; ++i) {
+		if (history->rows[i] == row) return false;
+	}
+	if (history->size == history->capacity) {
+		history->capacity = history->capacity > 0 ? history->capacity * 2 : 8;
+		history->rows = (uint32_t*)realloc(history->rows, history->capacity * sizeof(uint32_t));
+	}
+	history->rows[history->size++] = row;
+	return true;
+}
+
+//! ͬһظͬһĿظ
+void CBRecord(CoBorrowIndex *index, uint32_t borrower_id, void *book, uint32_t keyhash) {
+	if (!index) return;
+	uint32_t row = CBRow(index, book, keyhash);
+	PatronHistory *history = CBPatron(index, borrower_id);
+	if (!PHAdd(history, row)) return;
+	for (uint32_t i = 0; i + 1 < history->size; ++i) {
+		uint32_t other = history->rows[i];
+		uint32_t weight = ++*PTSlot(index->pairs, PTKey(row, other));
+		CBOffer(index, row, other, weight);
+		CBOffer(index, other, row, weight);
+	}
+}
+
+//! ھĿbooksweightsCB_TOP_N
+int CBLookup(CoBorrowIndex *index, void *book, uint32_t keyhash, void **books, uint32_t *weights) {
+	if (!index) return 0;
+	void *ref = NULL;
+	size_t cursor = 0;
+	while ((ref = HINext(index->rows, keyhash, &cursor)) != NULL) {
+		uint32_t row = (uint32_t)(uintptr_t)ref - 1;
+		if (index->books[row] != book) continue;
+		int degree = index->degree[row];
+		for (int i = 0; i < degree; ++i) {
+			books[i] = index->books[index->neighbors[(size_t)row * CB_TOP_N + i]];
+			weights[i] = index->weights[(size_t)row * CB_TOP_N + i];
+		}
+		return degree;
+	}
+	return 0;
+}
+
+/// 
+//! (ֶ, ģʽ)ΪLRUĿֽ˫޶
+#define SC_MAX_ENTRIES 128
+#define SC_MAX_BYTES (1 << 20)
+
+static inline uint32_t SCRowKey(void *row) {
+	return (uint32_t)((uintptr_t)row >> 4);
+}
+
+static inline uint32_t SCKey(int field, const char *pattern) {
+	return hash(pattern) ^ (uint32_t)field * 0x9e3779b1u;
+}
+
+SearchCache* MakeSearchCache(size_t max_entries, size_t max_bytes) {
+	SearchCache *cache = (SearchCache*)calloc(1, sizeof(SearchCache));
+	cache->lookup = MakeHashIndex(max_entries);
+	cache->rows = MakeHashIndex(0);
+	cache->max_entries = max_entries;
+	cache->max_bytes = max_bytes;
+	return cache;
+}
+
+static void SCUnlink(SearchCache *cache, SearchEntry *entry) {
+	if (entry->prev) entry->prev->next = entry->next; else cache->head = entry->next;
+	if (entry->next) entry->next->prev = entry->prev; else cache->tail = entry->prev;
+	entry->prev = entry->next = NULL;
+}
+
+static void SCPushFront(SearchCache *cache, SearchEntry *entry) {
+	entry->next = cache->head;
+	if (cache->head) cache->head->prev = entry; else cache->tail = entry;
+	cache->head = entry;
+}
+
+static void SCEvict(SearchCache *cache, SearchEntry *entry) {
+	SCUnlink(cache, entry);
+	HIErase(cache->lookup, entry->hashkey, entry);
+	for (size_t i = 0; i < entry->num; ++i) {
+		HIErase(cache->rows, SCRowKey(entry->results[i]), entry);
+	}
+	cache->bytes -= entry->bytes;
+	--cache->entries;
+	free(entry->pattern);
+	free(entry->results);
+	free(entry);
+}
+
+void SCDestroy(SearchCache *cache) {
+	if (!cache) return;
+	while (cache->head != NULL) {
+		SCEvict(cache, cache->head);
+	}
+	HIDestroy(cache->lookup);
+	HIDestroy(cache->rows);
+	free(cache);
+}
+
+static bool SCEntryMatch(SearchEntry *entry, void **args) {
+	return entry->field == *(int*)args[0] && strcmp(entry->pattern, (const char*)args[1]) == 0;
+}
+
+//! ʱؽ飬һλдǰЧ
+void** SCGet(SearchCache *cache, int field, const char *pattern, size_t *num) {
+	void *args[2] = { &field, (void*)pattern };
+	SearchEntry *entry = HIMatch(cache->lookup, SCKey(field, pattern), (TLMatchFn*)SCEntryMatch, args);
+	if (entry == NULL) {
+		++cache->misses;
+		return NULL;
+	}
+	++cache->hits;
+	SCUnlink(cache, entry);
+	SCPushFront(cache, entry);
+	*num = entry->num;
+	return entry->results;
+}
+
+void** SCPut(SearchCache *cache, int field, const char *pattern, void **results, size_t num) {
+	size_t bytes = sizeof(SearchEntry) + strlen(pattern) + 1 + num * (sizeof(void*) + sizeof(HashEntry));
+	if (bytes > cache->max_bytes) return NULL;
+	while (cache->tail != NULL && (cache->entries >= cache->max_entries
+		|| cache->bytes + bytes > cache->max_bytes)) {
+		SCEvict(cache, cache->tail);
+	}
+	SearchEntry *entry = (SearchEntry*)calloc(1, sizeof(SearchEntry));
+	entry->field = field;
+	entry->hashkey = SCKey(field, pattern);
+	entry->pattern = strdup(pattern);
+	entry->results = (void**)malloc((num > 0 ? num : 1) * sizeof(void*));
+	memcpy(entry->results, results, num * sizeof(void*));
+	entry->num = num;
+	entry->bytes = bytes;
+	HIInsert(cache->lookup, entry->hashkey, entry);
+	for (size_t i = 0; i < num; ++i) {
+		HIInsert(cache->rows, SCRowKey(results[i]), entry);
+	}
+	SCPushFront(cache, entry);
+	cache->bytes += bytes;
+	++cache->entries;
+	return entry->results;
+}
+
+//! Ŀ仯ʱʧЧеĿ
+void SCInvalidateRow(SearchCache *cache, void *row) {
+	if (!cache) return;
+	SearchEntry *entry = NULL;
+	size_t cursor = 0;
+	while ((entry = HINext(cache->rows, SCRowKey(row), &cursor)) != NULL) {
+		for (size_t i = 0; i < entry->num; ++i) {
+			if (entry->results[i] != row) continue;
+			SCEvict(cache, entry);
+			++cache->invalidations;
+			cursor = 0;
+			break;
+		}
+	}
+}
+
+//! ĿʱʧЧģʽƥ¼¼Ŀ
+void SCInvalidateInsert(SearchCache *cache, uint64_t isbn, const char *name, const char *author) {
+	if (!cache) return;
+	char name_key[256], author_key[256];
+	NormalizeText(name, name_key, sizeof(name_key));
+	NormalizeText(author, author_key, sizeof(author_key));
+	SearchEntry *entry = cache->head;
+	while (entry != NULL) {
+		SearchEntry *next = entry->next;
+		bool affected = entry->field == SearchISBN ? ISBNKey(entry->pattern) == isbn
+			: entry->field == SearchName ? TextContains(name, name_key, entry->pattern)
+			: TextContains(author, author_key, entry->pattern);
+		if (affected) {
+			SCEvict(cache, entry);
+			++cache->invalidations;
+		}
+		entry = next;
+	}
+}
+
+/// Ĺ鵵
+//! ѹ黹Ľ׷д<path>.arcѹ
+#define ARCHIVE_MAGIC 0x5241424c
+//! 1: ISBNǰ׺ 2: ISBNֱ
+#define ARCHIVE_VERSION 2
+
+typedef struct archivefileinfo_s {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t unused;
+	uint64_t count;
+} ArchiveFileInfo;
+
+//! ɰ鵵дУ´ʱ±д
+static void MigrateArchiveV1(BorrowArchive *archive, FILE *fp, uint64_t count) {
+	char prev[24] = { };
+	uint64_t prev_borrow = 0, chunk_remaining = 0;
+	while (count > 0) {
+		if (chunk_remaining == 0) {
+			if (!ReadVarint(fp, &chunk_remaining)) return;
+			memset(prev, 0, sizeof(prev));
+			prev_borrow = 0;
+			continue;
+		}
+		uint64_t borrower_id, loan_time, shared, suffix, tm_borrow, tm_return;
+		if (!ReadVarint(fp, &borrower_id) || !ReadVarint(fp, &loan_time)) return;
+		if (!ReadVarint(fp, &shared) || !ReadVarint(fp, &suffix)) return;
+		if (shared + suffix >= sizeof(prev)) return;
+		if (fread(prev + shared, 1, suffix, fp) != suffix) return;
+		prev[shared + suffix] = '\0';
+		if (!ReadVarint(fp, &tm_borrow) || !ReadVarint(fp, &tm_return)) return;
+		BorrowRecord record = { };
+		record.isbn = ISBNKey(prev);
+		record.borrower_id = borrower_id;
+		record.loan_time = loan_time;
+		prev_borrow += UnZigZag(tm_borrow);
+		UnpackTimestamp(&record.tm_borrow, prev_borrow);
+		UnpackTimestamp(&record.tm_return, prev_borrow + UnZigZag(tm_return));
+		TLAppend(archive->pending, &record);
+		--chunk_remaining;
+		--count;
+	}
+}
+
+BorrowArchive* OpenBorrowArchive(const char *path) {
+	BorrowArchive *archive = (BorrowArchive*)calloc(1, sizeof(BorrowArchive));
+	char buf[512];
+	snprintf(buf, sizeof(buf), "%s.arc", path);
+	archive->path = strdup(buf);
+	archive->pending = MakeTList(sizeof(BorrowRecord));
+	FILE *fp = fopen(archive->path, "rb");
+	if (fp != NULL) {
+		ArchiveFileInfo info = { };
+		if (fread(&info, sizeof(ArchiveFileInfo), 1, fp) == 1 && info.magic == ARCHIVE_MAGIC) {
+			archive->count = info.count;
+			if (info.version < ARCHIVE_VERSION) {
+				MigrateArchiveV1(archive, fp, info.count);
+				archive->rewrite = true;
+				archive->count = 0;
+			} else {
+				fseek(fp, 0, SEEK_END);
+				archive->bytes = ftell(fp);
+			}
+		}
+		fclose(fp);
+	}
+	return archive;
+}
+
+//! ռ¼ĳȣ֮д
+void TrimBorrowArchive(BorrowArchive *archive, uint64_t count, uint64_t bytes) {
+	if (archive->rewrite || count > archive->count || bytes > archive->bytes) return;
+	if (bytes == archive->bytes) return;
+	if (!TruncateFile(archive->path, bytes)) return;
+	archive->count = count;
+	archive->bytes = bytes;
+}
+
+void CloseBorrowArchive(BorrowArchive *archive) {
+	if (!archive) return;
+	TLDestroy(archive->pending);
+	free(archive->pending);
+	free(archive->path);
+	free(archive);
+}
+
+//! ISBNʱǰһ¼ֱ
+static void EncodeArchiveRecord(ByteBuffer *buffer, BorrowRecord *prev, BorrowRecord *record) {
+	uint64_t tm_borrow = PackTimestamp(&record->tm_borrow);
+	uint64_t tm_return = PackTimestamp(&record->tm_return);
+	BBPutVarint(buffer, record->borrower_id);
+	BBPutVarint(buffer, record->loan_time);
+	BBPutVarint(buffer, ZigZag(record->isbn - prev->isbn));
+	BBPutVarint(buffer, ZigZag(tm_borrow - PackTimestamp(&prev->tm_borrow)));
+	BBPutVarint(buffer, ZigZag(tm_return - tm_borrow));
+	memcpy(prev, record, sizeof(BorrowRecord));
+}
+
+static bool DecodeArchiveRecord(FILE *fp, BorrowRecord *prev, BorrowRecord *record) {
+	uint64_t borrower_id, loan_time, isbn, tm_borrow, tm_return;
+	if (!ReadVarint(fp, &borrower_id) || !ReadVarint(fp, &loan_time)) return false;
+	if (!ReadVarint(fp, &isbn)) return false;
+	if (!ReadVarint(fp, &tm_borrow) || !ReadVarint(fp, &tm_return)) return false;
+	memset(record, 0, sizeof(BorrowRecord));
+	record->isbn = prev->isbn + UnZigZag(isbn);
+	tm_borrow = PackTimestamp(&prev->tm_borrow) + UnZigZag(tm_borrow);
+	UnpackTimestamp(&record->tm_borrow, tm_borrow);
+	UnpackTimestamp(&record->tm_return, tm_borrow + UnZigZag(tm_return));
+	record->borrower_id = borrower_id;
+	record->loan_time = loan_time;
+	memcpy(prev, record, sizeof(BorrowRecord));
+	return true;
+}
+
+void ArchiveBorrowRecord(BorrowArchive *archive, BorrowRecord *record) {
+	assert(record->tm_return.year != -1);
+	TLAppend(archive->pending, record);
+}
+
+//! д¼Ϊ׷pathӦĹ鵵countbytesظļдļ¼Ч
+bool FlushBorrowArchive(BorrowArchive *archive, const char *path, uint64_t *count, uint64_t *bytes) {
+	char buf[512];
+	snprintf(buf, sizeof(buf), "%s.arc", path);
+	bool inplace = strcmp(buf, archive->path) == 0;
+	if (archive->rewrite) {
+		//! 鵵չͬһļļ
+		remove(buf);
+		FILE *fp = fopen(buf, "wb+");
+		if (fp == NULL) return false;
+		fclose(fp);
+	} else if (!inplace) {
+		FILE *src = fopen(archive->path, "rb"), *dst = fopen(buf, "wb+");
+		if (dst == NULL) {
+			if (src) fclose(src);
+			return false;
+		}
+		char block[65536];
+		size_t n = 0;
+		uint64_t left = archive->bytes;
+		while (src != NULL && left > 0
+			&& (n = fread(block, 1, left < sizeof(block) ? left : sizeof(block), src)) > 0) {
+			fwrite(block, 1, n, dst);
+			left -= n;
+		}
+		if (src) fclose(src);
+		fclose(dst);
+	}
+	*count = archive->rewrite ? 0 : archive->count;
+	*bytes = archive->rewrite ? 0 : archive->bytes;
+	if (archive->pending->head == NULL) return true;
+
+	FILE *fp = fopen(buf, "rb+");
+	if (fp == NULL) {
+		fp = fopen(buf, "wb+");
+	}
+	if (fp == NULL) return false;
+	ArchiveFileInfo info = { ARCHIVE_MAGIC, ARCHIVE_VERSION };
+	uint64_t offset = archive->rewrite ? 0 : archive->bytes;
+	info.count = archive->rewrite ? 0 : archive->count;
+
+	ByteBuffer chunk = { };
+	BorrowRecord prev = { };
+	uint64_t n = 0;
+	for (TListNode *p = archive->pending->head; p != NULL; p = p->next, ++n) {
+		EncodeArchiveRecord(&chunk, &prev, (BorrowRecord*)p->data);
+	}
+	ByteBuffer head = { };
+	BBPutVarint(&head, n);
+	//! дٸ¼жʱֹ߰
+	if (offset < sizeof(ArchiveFileInfo)) {
+		fseek(fp, 0, SEEK_SET);
+		fwrite(&info, sizeof(ArchiveFileInfo), 1, fp);
+		offset = sizeof(ArchiveFileInfo);
+	}
+	fseek(fp, offset, SEEK_SET);
+	fwrite(head.data, 1, head.size, fp);
+	fwrite(chunk.data, 1, chunk.size, fp);
+	fflush(fp);
+	info.count += n;
+	offset += head.size + chunk.size;
+	fseek(fp, 0, SEEK_SET);
+	bool succeed = fwrite(&info, sizeof(ArchiveFileInfo), 1, fp) == 1;
+	succeed = fflush(fp) == 0 && SyncFile(fileno(fp)) && succeed;
+	fclose(fp);
+	BBFree(&head);
+	BBFree(&chunk);
+	if (succeed) {
+		*count = info.count;
+		*bytes = offset;
+	}
+
+	if (inplace && succeed) {
+		archive->count = info.count;
+		archive->bytes = offset;
+		archive->rewrite = false;
+		TLDestroy(archive->pending);
+	}
+	return succeed;
+}
+
+//! Աȶ鵵ļٶδ̵ļ¼
+ArchiveCursor* OpenArchiveCursor(BorrowArchive *archive) {
+	ArchiveCursor *cursor = (ArchiveCursor*)calloc(1, sizeof(ArchiveCursor));
+	cursor->pending = archive->pending->head;
+	if (archive->count > 0 && (cursor->fp = fopen(archive->path, "rb")) != NULL) {
+		ArchiveFileInfo info = { };
+		if (fread(&info, sizeof(ArchiveFileInfo), 1, cursor->fp) == 1) {
+			cursor->remaining = archive->count;
+		}
+	}
+	return cursor;
+}
+
+bool ArchiveNext(ArchiveCursor *cursor, BorrowRecord *record) {
+	while (cursor->remaining > 0) {
+		if (cursor->chunk_remaining == 0) {
+			if (!ReadVarint(cursor->fp, &cursor->chunk_remaining)) break;
+			memset(&cursor->prev, 0, sizeof(BorrowRecord));
+			continue;
+		}
+		if (!DecodeArchiveRecord(cursor->fp, &cursor->prev, record)) break;
+		--cursor->chunk_remaining;
+		--cursor->remaining;
+		return true;
+	}
+	cursor->remaining = 0;
+	if (cursor->pending != NULL) {
+		memcpy(record, cursor->pending->data, sizeof(BorrowRecord));
+		cursor->pending = cursor->pending->next;
+		return true;
+	}
+	return false;
+}
+
+void CloseArchiveCursor(ArchiveCursor *cursor) {
+	if (cursor->fp) fclose(cursor->fp);
+	free(cursor);
+}
+
+/// ԤԼ
+//! λȺеԤԼڵ㣬׳ΪO(1)
+#define HOLD_KEEP_DAYS 3
+HoldQueue* MakeHoldQueue(uint64_t isbn) {
+	HoldQueue *queue = (HoldQueue*)calloc(1, sizeof(HoldQueue));
+	queue->isbn = isbn;
+	queue->capacity = 4;
+	queue->slots = (TListNode**)malloc(queue->capacity * sizeof(TListNode*));
+	return queue;
+}
+
+void HQDestroy(HoldQueue *queue) {
+	if (!queue) return;
+	free(queue->slots);
+	free(queue);
+}
+
+static inline TListNode* HQAt(HoldQueue *queue, uint32_t i) {
+	return queue->slots[(queue->head + i) % queue->capacity];
+}
+
+void HQPush(HoldQueue *queue, TListNode *node) {
+	if (queue->size == queue->capacity) {
+		TListNode **slots = (TListNode**)malloc(queue->capacity * 2 * sizeof(TListNode*));
+		for (uint32_t i = 0; i < queue->size; ++i) {
+			slots[i] = HQAt(queue, i);
+		}
+		free(queue->slots);
+		queue->slots = slots;
+		queue->head = 0;
+		queue->capacity *= 2;
+	}
+	queue->slots[(queue->head + queue->size) % queue->capacity] = node;
+	++queue->size;
+}
+
+//! Ƴָڵ㣬ڵ㱣ԭ˳
+bool HQRemove(HoldQueue *queue, TListNode *node) {
+	for (uint32_t i = 0; i < queue->size; ++i) {
+		if (HQAt(queue, i) != node) continue;
+		for (uint32_t j = i; j + 1 < queue->size; ++j) {
+			queue->slots[(queue->head + j) % queue->capacity] = HQAt(queue, j + 1);
+		}
+		--queue->size;
+		return true;
+	}
+	return false;
+}
+
+TListNode* HQPop(HoldQueue *queue) {
+	if (queue->size == 0) return NULL;
+	TListNode *node = queue->slots[queue->head];
+	queue->head = (queue->head + 1) % queue->capacity;
+	--queue->size;
+	return node;
+}
+
+/// ݹ
+//! 1: ַ 2: ISBNʶĿ 3: ԤԼ¼ 4: ԪϢ 5: ֿУ 6: Ƭ洢
+#define LIBRARYDB_VERSION 6
+
+static BookRecord* IndexedBook(LibraryDB *db, uint64_t isbn) {
+	BookRecord *book = NULL;
+	size_t cursor = 0;
+	while ((book = HINext(db->BookIndex, ISBNHash(isbn), &cursor)) != NULL) {
+		if (book->isbn == isbn) return book;
+	}
+	return NULL;
+}
+
+//! 
+void BuildAccountIndex(LibraryDB *db) {
+	HashIndex *index = MakeHashIndex(db->header.account_rec_num);
+	IDIndex *id_index = MakeIDIndex(db->header.next_account_id);
+	for (TListNode *p = db->AccountRecords->head; p != NULL; p = p->next) {
+		AccountRecord *record = (AccountRecord*)p->data;
+		HIInsert(index, record->hashkey, record);
+		IDIInsert(id_index, record->id, record);
+	}
+	db->AccountIndex = index;
+	db->AccountIDIndex = id_index;
+}
+
+void BuildBookIndex(LibraryDB *db) {
+	HashIndex *index = MakeHashIndex(db->header.book_rec_num);
+	HashIndex *author_index = MakeHashIndex(db->header.book_rec_num);
+	for (TListNode *p = db->BookRecords->head; p != NULL; p = p->next) {
+		BookRecord *record = (BookRecord*)p->data;
+		if (record->isbn == 0) {
+			record->isbn = ISBNKey(record->ISBN);
+		}
+		HIInsert(index, ISBNHash(record->isbn), record);
+		HIInsert(author_index, record->author, record);
+	}
+	db->BookIndex = index;
+	db->AuthorIndex = author_index;
+}
+
+//! ɰеѹ黹¼ڴǨ鵵
+void BuildLoanIndex(LibraryDB *db) {
+	HashIndex *index = MakeHashIndex(db->header.borrow_rec_num);
+	TListNode *p = db->BorrowRecords->head;
+	while (p != NULL) {
+		TListNode *node = p;
+		BorrowRecord *record = (BorrowRecord*)node->data;
+		p = p->next;
+		if (record->tm_return.year == -1) {
+			HIInsert(index, record->borrower_id, node);
+		} else if (TLErase(db->BorrowRecords, node)) {
+			ArchiveBorrowRecord(db->BorrowHistory, record);
+			--db->header.borrow_rec_num;
+			free(record);
+			free(node);
+		}
+	}
+	db->LoanIndex = index;
+}
+
+HoldQueue* FindHoldQueue(LibraryDB *db, uint64_t isbn, bool create) {
+	HoldQueue *queue = NULL;
+	size_t cursor = 0;
+	while ((queue = HINext(db->HoldIndex, ISBNHash(isbn), &cursor)) != NULL) {
+		if (queue->isbn == isbn) return queue;
+	}
+	if (!create) return NULL;
+	queue = MakeHoldQueue(isbn);
+	HIInsert(db->HoldIndex, ISBNHash(isbn), queue);
+	return queue;
+}
+
+//! ԤԼ¼˳򱣴棬ؽʱISBNбȵ
+void BuildHoldIndex(LibraryDB *db) {
+	db->HoldIndex = MakeHashIndex(0);
+	db->Inbox = MakeHashIndex(0);
+	for (TListNode *p = db->HoldRecords->head; p != NULL; p = p->next) {
+		HoldRecord *record = (HoldRecord*)p->data;
+		if (record->tm_ready.year == -1) {
+			HQPush(FindHoldQueue(db, record->isbn, true), p);
+		} else {
+			HIInsert(db->Inbox, record->patron_id, p);
+		}
+	}
+}
+
+void BuildAccountFilter(LibraryDB *db) {
+	BloomFilter *filter = MakeBloomFilter(db->header.account_rec_num * 2);
+	for (TListNode *p = db->AccountRecords->head; p != NULL; p = p->next) {
+		BFInsert(filter, hash64(((AccountRecord*)p->data)->account));
+	}
+	db->AccountFilter = filter;
+}
+
+void BuildBookFilter(LibraryDB *db) {
+	BloomFilter *filter = MakeBloomFilter(db->header.book_rec_num * 2);
+	for (TListNode *p = db->BookRecords->head; p != NULL; p = p->next) {
+		BFInsert(filter, ISBNHash64(((BookRecord*)p->data)->isbn));
+	}
+	db->BookFilter = filter;
+}
+
+//! ISBNǰ׺13λ淶ʽΪISBN-10Ŀͬɰ978ǰ׺ȫ
+void RTInsertISBN(RadixTrie *trie, BookRecord *book) {
+	char key[24];
+	if (book->isbn & ISBN_LEGACY) {
+		NormalizeISBN(book->ISBN, key, sizeof(key));
+	} else {
+		FormatISBN(book->isbn, key, sizeof(key));
+	}
+	RTInsert(trie, key, book);
+}
+
+void BuildPrefixTries(LibraryDB *db) {
+	RadixTrie *isbn_trie = MakeRadixTrie(false);
+	RadixTrie *title_trie = MakeRadixTrie(true);
+	for (TListNode *p = db->BookRecords->head; p != NULL; p = p->next) {
+		BookRecord *record = (BookRecord*)p->data;
+		RTInsertISBN(isbn_trie, record);
+		RTInsert(title_trie, SPKey(db->Strings, record->name), record);
+	}
+	db->ISBNTrie = isbn_trie;
+	db->TitleTrie = title_trie;
+}
+
+//! ݿ־û<path>.bloomԼ¼ָʶݿǷѱ滻
+#define BLOOM_MAGIC 0x32424c4c
+
+typedef struct bloomfileinfo_s {
+	uint32_t magic;
+	uint32_t account_rec_num;
+	uint32_t book_rec_num;
+	uint32_t unused;
+	uint64_t fingerprint;
+} BloomFileInfo;
+
+typedef struct sidecarfile_s {
+	LibraryDB *db;
+	const char *path;
+	uint64_t fingerprint;  //@ ĹӦָ
+} SidecarFile;
+
+//! ˻Ŀͣ¼Ƭʽ
+uint64_t BloomFingerprint(LibraryDB *db) {
+	uint64_t fingerprint = 0;
+	for (TListNode *p = db->AccountRecords->head; p != NULL; p = p->next) {
+		AccountRecord *record = (AccountRecord*)p->data;
+		fingerprint += (((uint64_t)record->hashkey << 32) | record->id) * 0x9e3779b97f4a7c15ull;
+	}
+	for (TListNode *p = db->BookRecords->head; p != NULL; p = p->next) {
+		fingerprint += (((BookRecord*)p->data)->isbn ^ 0x5bd1e995) * 0xff51afd7ed558ccdull;
+	}
+	return fingerprint;
+}
+
+static void LoadBloomFilters(SidecarFile *file) {
+	char path[512];
+	snprintf(path, sizeof(path), "%s.bloom", file->path);
+	FILE *fp = fopen(path, "rb");
+	if (fp == NULL) return;
+	LibraryDB *db = file->db;
+	BloomFileInfo info = { };
+	if (fread(&info, sizeof(BloomFileInfo), 1, fp) == 1 && info.magic == BLOOM_MAGIC
+		&& info.account_rec_num == db->header.account_rec_num
+		&& info.book_rec_num == db->header.book_rec_num) {
+		BloomFilter *account_filter = ReadBloomFilter(fp);
+		BloomFilter *book_filter = ReadBloomFilter(fp);
+		if (account_filter != NULL && !BFOverloaded(account_filter)) {
+			db->AccountFilter = account_filter;
+		} else {
+			BFDestroy(account_filter);
+		}
+		if (book_filter != NULL && !BFOverloaded(book_filter)) {
+			db->BookFilter = book_filter;
+		} else {
+			BFDestroy(book_filter);
+		}
+		file->fingerprint = info.fingerprint;
+	}
+	fclose(fp);
+}
+
+bool ExportBloomFilters(LibraryDB *db, const char *path) {
+	char buf[512];
+	snprintf(buf, sizeof(buf), "%s.bloom", path);
+	if (!db->AccountFilter || !db->BookFilter) return false;
+	FILE *fp = fopen(buf, "wb+");
+	if (fp == NULL) return false;
+	BloomFileInfo info = { BLOOM_MAGIC, db->header.account_rec_num, db->header.book_rec_num, 0, BloomFingerprint(db) };
+	fwrite(&info, sizeof(BloomFileInfo), 1, fp);
+	WriteBloomFilter(db->AccountFilter, fp);
+	WriteBloomFilter(db->BookFilter, fp);
+	fclose(fp);
+	return true;
+}
+
+//! ȶͳƳ־û<path>.popȱʧ汾ʱɽʷؽ
+#define POPULARITY_MAGIC 0x32504f50
+
+static void LoadPopularity(SidecarFile *file) {
+	char path[512];
+	snprintf(path, sizeof(path), "%s.pop", file->path);
+	FILE *fp = fopen(path, "rb");
+	if (fp == NULL) return;
+	uint32_t magic = 0;
+	HeavyHitters *hitters = MakeHeavyHitters();
+	if (fread(&magic, sizeof(uint32_t), 1, fp) == 1 && magic == POPULARITY_MAGIC
+		&& ReadHeavyHitters(hitters, fp)) {
+		file->db->Popularity = hitters;
+	} else {
+		free(hitters);
+	}
+	fclose(fp);
+}
+
+bool ExportPopularity(LibraryDB *db, const char *path) {
+	char buf[512];
+	snprintf(buf, sizeof(buf), "%s.pop", path);
+	if (!db->Popularity) return false;
+	FILE *fp = fopen(buf, "wb+");
+	if (fp == NULL) return false;
+	uint32_t magic = POPULARITY_MAGIC;
+	fwrite(&magic, sizeof(uint32_t), 1, fp);
+	WriteHeavyHitters(db->Popularity, fp);
+	fclose(fp);
+	return true;
+}
+
+typedef struct popularitybuild_s {
+	LibraryDB *db;
+	bool counters;
+	bool windows;
+} PopularityBuild;
+
+//! ɨʷȱʧۼƼڴ
+static void BuildPopularity(PopularityBuild *build) {
+	LibraryDB *db = build->db;
+	Timestamp now;
+	GetTimestamp(&now);
+	int32_t today = GetDayNumber(&now);
+	HeavyHitters *hitters = build->windows ? MakeHeavyHitters() : NULL;
+	ArchiveCursor *cursor = OpenArchiveCursor(db->BorrowHistory);
+	TListNode *p = db->BorrowRecords->head;
+	BorrowRecord history;
+	while (true) {
+		BorrowRecord *record = &history;
+		if (!ArchiveNext(cursor, record)) {
+			if (p == NULL) break;
+			record = (BorrowRecord*)p->data;
+			p = p->next;
+		}
+		if (build->counters) {
+			BookRecord *book = IndexedBook(db, record->isbn);
+			if (book != NULL) {
+				++book->borrow_count;
+			}
+		}
+		int32_t day = GetDayNumber(&record->tm_borrow);
+		if (hitters != NULL && day > today - HH_WINDOW_NUM && day <= today) {
+			HHRecord(hitters, record->isbn, day);
+		}
+	}
+	CloseArchiveCursor(cursor);
+	if (hitters != NULL) {
+		db->Popularity = hitters;
+	}
+}
+
+//! ͬɽʷй߷ƬٺϲǰN
+typedef struct loanevent_s {
+	uint32_t borrower_id;
+	uint32_t row;
+} LoanEvent;
+
+typedef struct coborrowpart_s {
+	LoanEvent *events;
+	size_t begin, end;
+	PairTable *pairs;
+} CoBorrowPart;
+
+static int CompareLoanEvent(const void *lhs, const void *rhs) {
+	const LoanEvent *a = lhs, *b = rhs;
+	if (a->borrower_id != b->borrower_id) return a->borrower_id < b->borrower_id ? -1 : 1;
+	if (a->row != b->row) return a->row < b->row ? -1 : 1;
+	return 0;
+}
+
+static void CountCoBorrowPart(CoBorrowPart *part) {
+	part->pairs = MakePairTable(0);
+	size_t i = part->begin;
+	while (i < part->end) {
+		size_t j = i;
+		while (j < part->end && part->events[j].borrower_id == part->events[i].borrower_id) {
+			++j;
+		}
+		for (size_t a = i; a < j; ++a) {
+			for (size_t b = a + 1; b < j; ++b) {
+				++*PTSlot(part->pairs, PTKey(part->events[a].row, part->events[b].row));
+			}
+		}
+		i = j;
+	}
+}
+
+typedef struct coborrowbuild_s {
+	LibraryDB *db;
+	ThreadPool *pool;
+	CoBorrowIndex *index;
+	LoanEvent *events;    //@ ȥغĽ
+	size_t unique;
+} CoBorrowBuild;
+
+//! ΪУȫĲǼǸߵĿ
+static void CollectCoBorrowEvents(CoBorrowBuild *build) {
+	LibraryDB *db = build->db;
+	CoBorrowIndex *index = MakeCoBorrowIndex();
+	size_t num = 0, capacity = 1024;
+	LoanEvent *events = (LoanEvent*)malloc(capacity * sizeof(LoanEvent));
+	ArchiveCursor *cursor = OpenArchiveCursor(db->BorrowHistory);
+	TListNode *p = db->BorrowRecords->head;
+	BorrowRecord history;
+	while (true) {
+		BorrowRecord *record = &history;
+		if (!ArchiveNext(cursor, record)) {
+			if (p == NULL) break;
+			record = (BorrowRecord*)p->data;
+			p = p->next;
+		}
+		BookRecord *book = IndexedBook(db, record->isbn);
+		if (book == NULL) continue;
+		if (num == capacity) {
+			capacity *= 2;
+			events = (LoanEvent*)realloc(events, capacity * sizeof(LoanEvent));
+		}
+		events[num].borrower_id = record->borrower_id;
+		events[num].row = CBRow(index, book, ISBNHash(book->isbn));
+		++num;
+	}
+	CloseArchiveCursor(cursor);
+
+	qsort(events, num, sizeof(LoanEvent), CompareLoanEvent);
+	size_t unique = 0;
+	for (size_t i = 0; i < num; ++i) {
+		if (unique == 0 || CompareLoanEvent(&events[unique - 1], &events[i]) != 0) {
+			events[unique++] = events[i];
+		}
+	}
+	for (size_t i = 0; i < unique; ++i) {
+		PHAdd(CBPatron(index, events[i].borrower_id), events[i].row);
+	}
+	build->index = index;
+	build->events = events;
+	build->unique = unique;
+}
+
+//! ּƬύbuild->poolȴɳ̵߳
+static void BuildCoBorrowIndex(CoBorrowBuild *build) {
+	CoBorrowIndex *index = build->index;
+	LoanEvent *events = build->events;
+	size_t unique = build->unique;
+	//! Ƭ߽뵽ߣͬһ߿Ƭ
+	size_t nparts = build->pool->nthreads;
+	CoBorrowPart *parts = (CoBorrowPart*)calloc(nparts, sizeof(CoBorrowPart));
+	for (size_t i = 0, begin = 0; i < nparts; ++i) {
+		size_t end = i + 1 == nparts ? unique : unique * (i + 1) / nparts;
+		while (end > begin && end < unique && events[end].borrower_id == events[end - 1].borrower_id) {
+			++end;
+		}
+		if (end < begin) end = begin;
+		parts[i].events = events;
+		parts[i].begin = begin;
+		parts[i].end = end;
+		TPSubmit(build->pool, (TPTaskFn*)CountCoBorrowPart, &parts[i]);
+		begin = end;
+	}
+	TPWait(build->pool);
+	for (size_t i = 0; i < nparts; ++i) {
+		PairTable *pairs = parts[i].pairs;
+		for (size_t k = 0; k < pairs->capacity; ++k) {
+			if (pairs->keys[k] == 0) continue;
+			*PTSlot(index->pairs, pairs->keys[k]) += pairs->counts[k];
+		}
+		PTDestroy(pairs);
+	}
+	for (size_t k = 0; k < index->pairs->capacity; ++k) {
+		uint64_t key = index->pairs->keys[k];
+		if (key == 0) continue;
+		uint32_t a = (key >> 32) - 1, b = (uint32_t)key - 1;
+		CBOffer(index, a, b, index->pairs->counts[k]);
+		CBOffer(index, b, a, index->pairs->counts[k]);
+	}
+	free(parts);
+	free(events);
+	build->db->CoBorrow = index;
+}
+
+//! ֶβм
+typedef struct dbsection_s {
+	LibraryDB *db;
+	ThreadPool *pool;
+	const char *path;
+	TList *list;
+	size_t rec_size;
+	size_t rec_num;
+	int64_t offset;
+	TPTaskFn *indexer;
+	void (*convert)(LibraryDB *db, void *record, const void *raw);
+	bool succeed;
+	char *data;    //@ ԤĽ
+} DBSection;
+
+//! ɰĿ洢
+static void ConvertBookRecordV0(LibraryDB *db, BookRecord *record, const BookRecordV0 *raw) {
+	char author[sizeof(raw->author) + 1] = { }, name[sizeof(raw->name) + 1] = { };
+	memcpy(author, raw->author, sizeof(raw->author));
+	memcpy(name, raw->name, sizeof(raw->name));
+	record->stock = raw->stock;
+	memcpy(record->ISBN, raw->ISBN, sizeof(record->ISBN));
+	record->author = SPIntern(db->Strings, author);
+	record->name = SPIntern(db->Strings, name);
+	record->tm_introduce = raw->tm_introduce;
+}
+
+//! ɰļ¼洢ISBNַ
+static void ConvertBorrowRecordV1(LibraryDB *db, BorrowRecord *record, const BorrowRecordV1 *raw) {
+	char ISBN[sizeof(raw->ISBN) + 1] = { };
+	memcpy(ISBN, raw->ISBN, sizeof(raw->ISBN));
+	record->isbn = ISBNKey(ISBN);
+	record->loan_time = raw->loan_time;
+	record->borrower_id = raw->borrower_id;
+	record->tm_borrow = raw->tm_borrow;
+	record->tm_return = raw->tm_return;
+}
+
+static void LoadStringPoolSection(DBSection *section) {
+	uint32_t info[2] = { };
+	int fd = open(section->path, O_RDONLY | O_BINARY);
+	section->succeed = false;
+	if (fd < 0) return;
+	if (ReadAt(fd, info, sizeof(info), section->offset)) {
+		char *buffer = (char*)malloc(info[1] + 1);
+		section->succeed = ReadAt(fd, buffer, info[1], section->offset + sizeof(info))
+			&& ReadStringPool(section->db->Strings, buffer, info[1], info[0]);
+		section->rec_size = sizeof(info) + info[1]; // section length, locates the next section
+		free(buffer);
+	}
+	close(fd);
+}
+
+static void LoadDBSection(DBSection *section) {
+	size_t total = section->rec_size * section->rec_num;
+	char *buffer = section->data;
+	int fd = -1;
+	section->succeed = total == 0 || buffer != NULL;
+	if (!section->succeed) {
+		buffer = (char*)malloc(total);
+		fd = open(section->path, O_RDONLY | O_BINARY);
+	}
+	if (fd >= 0) {
+		section->succeed = ReadAt(fd, buffer, total, section->offset);
+		close(fd);
+	}
+	if (section->succeed) {
+		size_t size = section->rec_size < section->list->node_size
+			? section->rec_size : section->list->node_size;
+		for (size_t n = 0; n < section->rec_num; ++n) {
+			void *record = TLAppend(section->list, NULL);
+			if (section->convert != NULL) {
+				section->convert(section->db, record, buffer + n * section->rec_size);
+			} else {
+				memcpy(record, buffer + n * section->rec_size, size);
+			}
+		}
+		TPSubmit(section->pool, section->indexer, section->db);
+	}
+	free(buffer);
+}
+
+//! ԤԼԼ¼СĿͷ
+static void LoadHoldSection(DBSection *section) {
+	uint32_t info[2] = { };
+	int fd = open(section->path, O_RDONLY | O_BINARY);
+	section->succeed = fd >= 0 && ReadAt(fd, info, sizeof(info), section->offset);
+	if (fd >= 0) close(fd);
+	if (!section->succeed) return;
+	section->rec_size = info[0];
+	section->rec_num = info[1];
+	section->offset += sizeof(info);
+	LoadDBSection(section);
+}
+
+//! Ƭ洢˻IDĿİISBNɢл<path>.<Ƭ>.<>
+
+static inline uint32_t AccountShard(LibraryDB *db, uint32_t id) {
+	return id % db->nshards;
+}
+
+static inline uint32_t BookShard(LibraryDB *db, uint64_t isbn) {
+	return ISBNHash(isbn) % db->nshards;
+}
+
+static void ShardPath(char *buf, size_t size, const char *path, uint32_t shard, uint64_t generation) {
+	snprintf(buf, size, "%s.%u.%llu", path, shard, (unsigned long long)generation);
+}
+
+//! ½ɵļǨʱȷƬȫƬд
+static void InitShards(LibraryDB *db) {
+	const char *env = getenv("LIBSYS_SHARDS");
+	long nshards = env != NULL ? atol(env) : DB_SHARDS;
+	db->nshards = nshards < 1 ? 1 : nshards > DB_MAX_SHARDS ? DB_MAX_SHARDS : nshards;
+	db->ShardGenerations = (uint64_t*)calloc(db->nshards, sizeof(uint64_t));
+	db->dirty_shards = db->nshards == 64 ? ~0ull : (1ull << db->nshards) - 1;
+}
+
+static uint64_t AccountOrder(const void *data) {
+	return ((const AccountRecord*)data)->id;
+}
+
+static uint64_t BookOrder(const void *data) {
+	return PackTimestamp(&((const BookRecord*)data)->tm_introduce);
+}
+
+static uint64_t BorrowOrder(const void *data) {
+	return PackTimestamp(&((const BorrowRecord*)data)->tm_borrow);
+}
+
+static void ShardLoadRecords(TList *list, const char *data, size_t rec_size, uint32_t num) {
+	size_t size = rec_size < list->node_size ? rec_size : list->node_size;
+	for (uint32_t n = 0; n < num; ++n) {
+		memcpy(TLAppend(list, NULL), data + n * rec_size, size);
+	}
+}
+
+//! 벢У鵥Ƭ˽Ƭ
+static void LoadShard(DBShard *shard) {
+	char path[512];
+	ShardPath(path, sizeof(path), shard->path, shard->index, shard->generation);
+	ChecksumInfo checksums = { };
+	uint32_t *table = ReadChecksums(path, &checksums);
+	char *data = table != NULL ? (char*)malloc(checksums.data_size + 1) : NULL;
+	int fd = table != NULL ? open(path, O_RDONLY | O_BINARY) : -1;
+	shard->succeed = fd >= 0 && ReadAt(fd, data, checksums.data_size, 0);
+	if (fd >= 0) close(fd);
+	for (uint32_t n = 0; shard->succeed && n < checksums.nblocks; ++n) {
+		uint64_t offset = (uint64_t)n * checksums.block_size;
+		uint64_t left = checksums.data_size - offset;
+		shard->succeed = CRC32C(data + offset, left < checksums.block_size ? left : checksums.block_size) == table[n];
+	}
+	ShardFileInfo info = { };
+	if (shard->succeed && checksums.data_size >= sizeof(ShardFileInfo)) {
+		memcpy(&info, data, sizeof(ShardFileInfo));
+		shard->succeed = info.magic == SHARD_MAGIC && info.shard == shard->index
+			&& sizeof(ShardFileInfo) + (uint64_t)info.account_rec_size * info.account_rec_num
+				+ (uint64_t)info.book_rec_size * info.book_rec_num
+				+ (uint64_t)info.borrow_rec_size * info.borrow_rec_num == checksums.data_size;
+	} else {
+		shard->succeed = false;
+	}
+	if (shard->succeed) {
+		const char *p = data + sizeof(ShardFileInfo);
+		ShardLoadRecords(shard->accounts, p, info.account_rec_size, info.account_rec_num);
+		p += (size_t)info.account_rec_size * info.account_rec_num;
+		ShardLoadRecords(shard->books, p, info.book_rec_size, info.book_rec_num);
+		p += (size_t)info.book_rec_size * info.book_rec_num;
+		ShardLoadRecords(shard->borrows, p, info.borrow_rec_size, info.borrow_rec_num);
+	}
+	free(data);
+	free(table);
+}
+
+//! дѱźõķƬӳ
+static void ExportShard(DBShard *shard) {
+	char path[512];
+	ShardPath(path, sizeof(path), shard->path, shard->index, shard->generation);
+	AppendChecksums(&shard->image);
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+	shard->succeed = fd >= 0 && IOWriteSync(shard->io, fd, shard->image.data, shard->image.size, 0);
+	if (fd >= 0) close(fd);
+	BBFree(&shard->image);
+}
+
+//! Ƭż¼maskеķƬ
+static void LayoutShards(LibraryDB *db, DBShard *shards, uint64_t mask) {
+	ShardFileInfo *info = (ShardFileInfo*)calloc(db->nshards, sizeof(ShardFileInfo));
+	for (uint32_t k = 0; k < db->nshards; ++k) {
+		if (mask >> k & 1) BBWrite(&shards[k].image, &info[k], sizeof(ShardFileInfo));
+	}
+	for (TListNode *p = db->AccountRecords->head; p != NULL; p = p->next) {
+		uint32_t k = AccountShard(db, ((AccountRecord*)p->data)->id);
+		if (!(mask >> k & 1)) continue;
+		BBWrite(&shards[k].image, p->data, db->AccountRecords->node_size);
+		++info[k].account_rec_num;
+	}
+	for (TListNode *p = db->BookRecords->head; p != NULL; p = p->next) {
+		uint32_t k = BookShard(db, ((BookRecord*)p->data)->isbn);
+		if (!(mask >> k & 1)) continue;
+		BBWrite(&shards[k].image, p->data, db->BookRecords->node_size);
+		++info[k].book_rec_num;
+	}
+	for (TListNode *p = db->BorrowRecords->head; p != NULL; p = p->next) {
+		uint32_t k = BookShard(db, ((BorrowRecord*)p->data)->isbn);
+		if (!(mask >> k & 1)) continue;
+		BBWrite(&shards[k].image, p->data, db->BorrowRecords->node_size);
+		++info[k].borrow_rec_num;
+	}
+	for (uint32_t k = 0; k < db->nshards; ++k) {
+		if (!(mask >> k & 1)) continue;
+		info[k].magic = SHARD_MAGIC;
+		info[k].shard = k;
+		info[k].nshards = db->nshards;
+		info[k].generation = shards[k].generation;
+		info[k].account_rec_size = db->AccountRecords->node_size;
+		info[k].book_rec_size = db->BookRecords->node_size;
+		info[k].borrow_rec_size = db->BorrowRecords->node_size;
+		memcpy(shards[k].image.data, &info[k], sizeof(ShardFileInfo));
+	}
+	free(info);
+}
+
+//! 漰˻ĿڷƬΪд
+static void MarkShardsDirty(LibraryDB *db, const Mutation *m) {
+	uint32_t id = m->op == OpRegister ? (uint32_t)m->result : m->id;
+	uint64_t isbn = m->op == OpAddBook ? ParseISBN(m->text[0]) : m->isbn;
+	if (db->nshards == 0) return;
+	if (id != 0) db->dirty_shards |= 1ull << AccountShard(db, id);
+	if (isbn != 0) db->dirty_shards |= 1ull << BookShard(db, isbn);
+}
+
+//! 嵥Ƭ븽ļڻط
+bool CopyLibraryDB(const char *src, const char *dst) {
+	const char *suffixes[] = { "", ".arc", ".bloom", ".pop" };
+	for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); ++i) {
+		char from[512], to[512];
+		snprintf(from, sizeof(from), "%s%s", src, suffixes[i]);
+		snprintf(to, sizeof(to), "%s%s", dst, suffixes[i]);
+		remove(to);
+		if (!DuplicateFile(from, to) && i == 0) return false;
+	}
+	//! ѸƵ嵥ȡƬԴ嵥󱻼滻Ҳ´
+	DBManifest manifest = { };
+	FILE *fp = fopen(dst, "rb");
+	if (fp == NULL) return false;
+	bool succeed = fread(&manifest, sizeof(DBManifest), 1, fp) == 1;
+	if (!succeed || manifest.header.version < 6 || manifest.nshards > DB_MAX_SHARDS) {
+		fclose(fp);
+		return succeed;
+	}
+	uint64_t generations[DB_MAX_SHARDS] = { };
+	succeed = fread(generations, sizeof(uint64_t), manifest.nshards, fp) == manifest.nshards;
+	fclose(fp);
+	for (uint32_t k = 0; succeed && k < manifest.nshards; ++k) {
+		char from[512], to[512];
+		ShardPath(from, sizeof(from), src, k, generations[k]);
+		ShardPath(to, sizeof(to), dst, k, generations[k]);
+		remove(to);
+		succeed = DuplicateFile(from, to);
+	}
+	return succeed;
+}
+
+//! ȡ嵥õĸƬţطƬǷƬʽ޷ȡʱ0
+static uint32_t ReadShardGenerations(const char *path, uint64_t *generations) {
+	DBManifest manifest = { };
+	FILE *fp = fopen(path, "rb");
+	if (fp == NULL) return 0;
+	if (fread(&manifest, sizeof(DBManifest), 1, fp) != 1 || manifest.header.version < 6
+		|| manifest.nshards > DB_MAX_SHARDS
+		|| fread(generations, sizeof(uint64_t), manifest.nshards, fp) != manifest.nshards) {
+		manifest.nshards = 0;
+	}
+	fclose(fp);
+	return manifest.nshards;
+}
+
+//! Ӳ㣺ƬдٸĶ鵵׷Ҷȡʱ嵥¼ĳȽضϸ
+//! Դ嵥븽ļᱻԭд븴
+bool LinkLibraryDB(const char *src, const char *dst) {
+	char from[512], to[512];
+	const char *suffixes[] = { "", ".bloom", ".pop" };
+	for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); ++i) {
+		snprintf(from, sizeof(from), "%s%s", src, suffixes[i]);
+		snprintf(to, sizeof(to), "%s%s", dst, suffixes[i]);
+		remove(to);
+		if (!DuplicateFile(from, to) && i == 0) return false;
+	}
+	snprintf(from, sizeof(from), "%s.arc", src);
+	snprintf(to, sizeof(to), "%s.arc", dst);
+	if (access(from, F_OK) == 0 && !LinkFile(from, to)) return false;
+	uint64_t generations[DB_MAX_SHARDS] = { };
+	uint32_t nshards = ReadShardGenerations(dst, generations);
+	for (uint32_t k = 0; k < nshards; ++k) {
+		ShardPath(from, sizeof(from), src, k, generations[k]);
+		ShardPath(to, sizeof(to), dst, k, generations[k]);
+		if (!LinkFile(from, to)) return false;
+	}
+	return true;
+}
+
+//! ɾ嵥õķƬ븽ļ
+void RemoveLibraryDB(const char *path) {
+	uint64_t generations[DB_MAX_SHARDS] = { };
+	uint32_t nshards = ReadShardGenerations(path, generations);
+	char buf[512];
+	for (uint32_t k = 0; k < nshards; ++k) {
+		ShardPath(buf, sizeof(buf), path, k, generations[k]);
+		remove(buf);
+	}
+	const char *suffixes[] = { ".arc", ".bloom", ".pop", ".wal", ".wal.old", ".tmp" };
+	for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); ++i) {
+		snprintf(buf, sizeof(buf), "%s%s", path, suffixes[i]);
+		remove(buf);
+	}
+	remove(path);
+}
+
+//! src滻dstƬ븽ļ滻嵥ʹЧٻdstľɷƬ
+//! srcķƬŲdstзƬ滻ǰжϻƻdst
+bool ReplaceLibraryDB(const char *src, const char *dst) {
+	uint64_t src_generations[DB_MAX_SHARDS] = { }, dst_generations[DB_MAX_SHARDS] = { };
+	uint32_t nsrc = ReadShardGenerations(src, src_generations);
+	uint32_t ndst = ReadShardGenerations(dst, dst_generations);
+	if (nsrc == 0) return false;
+	for (uint32_t k = 0; k < nsrc && k < ndst; ++k) {
+		if (src_generations[k] == dst_generations[k]) return false;
+	}
+	char from[512], to[512];
+	for (uint32_t k = 0; k < nsrc; ++k) {
+		ShardPath(from, sizeof(from), src, k, src_generations[k]);
+		ShardPath(to, sizeof(to), dst, k, src_generations[k]);
+		if (rename(from, to) != 0) return false;
+	}
+	const char *suffixes[] = { ".arc", ".bloom", ".pop" };
+	for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); ++i) {
+		snprintf(from, sizeof(from), "%s%s", src, suffixes[i]);
+		snprintf(to, sizeof(to), "%s%s", dst, suffixes[i]);
+		remove(to);
+		if (access(from, F_OK) == 0 && rename(from, to) != 0) return false;
+	}
+	//! dst־嵥Чǰ򿪻ʱᱻطŵ滻
+	snprintf(to, sizeof(to), "%s.wal", dst);
+	remove(to);
+	snprintf(to, sizeof(to), "%s.wal.old", dst);
+	remove(to);
+#ifdef _WIN32
+	remove(dst);
+#endif
+	if (rename(src, dst) != 0) return false;
+	for (uint32_t k = 0; k < ndst; ++k) {
+		if (k < nsrc && src_generations[k] == dst_generations[k]) continue;
+		ShardPath(to, sizeof(to), dst, k, dst_generations[k]);
+		remove(to);
+	}
+	return true;
+}
+
+//! ڴбźһдʱļ滻жʱһ
+bool ExportLibraryDB(LibraryDB *db, const char *path) {
+	if (!db) return false;
+	//! ʱд¼ֻĿ鵵Ԫ¼Ŀļļ볤
+	uint64_t archive_count = 0, archive_bytes = 0;
+	if (!FlushBorrowArchive(db->BorrowHistory, path, &archive_count, &archive_bytes)) return false;
+	//! ԭؼ´дƬʱдȫƬ
+	char arc[512];
+	snprintf(arc, sizeof(arc), "%s.arc", path);
+	bool inplace = strcmp(arc, db->BorrowHistory->path) == 0;
+	uint64_t mask = inplace ? db->dirty_shards : ~0ull;
+	DBShard *shards = (DBShard*)calloc(db->nshards, sizeof(DBShard));
+	size_t ndirty = 0;
+	for (uint32_t k = 0; k < db->nshards; ++k) {
+		shards[k].db = db;
+		shards[k].path = path;
+		shards[k].index = k;
+		shards[k].generation = db->ShardGenerations[k] + (inplace && (mask >> k & 1));
+		shards[k].succeed = true;
+		ndirty += mask >> k & 1;
+	}
+	LayoutShards(db, shards, mask);
+	if (ndirty > 0) {
+		//! io_uringͬһ˵дͬ봮Уд߳⻥ȴ
+		size_t nthreads = ndirty < GetProcessorNum() ? ndirty : GetProcessorNum();
+		size_t nbackends = IOBatched(db->IO) && nthreads > 1 ? nthreads : 0;
+		IOBackend **backends = (IOBackend**)calloc(nbackends + 1, sizeof(IOBackend*));
+		for (size_t i = 0; i < nbackends; ++i) {
+			backends[i] = MakeIOBackend();
+		}
+		ThreadPool *pool = MakeThreadPool(nthreads);
+		for (uint32_t k = 0, i = 0; k < db->nshards; ++k) {
+			if (!(mask >> k & 1)) continue;
+			shards[k].io = nbackends > 0 ? backends[i++ % nbackends] : db->IO;
+			TPSubmit(pool, (TPTaskFn*)ExportShard, &shards[k]);
+		}
+		TPWait(pool);
+		TPDestroy(pool);
+		for (size_t i = 0; i < nbackends; ++i) {
+			db->IO->syscalls += backends[i]->syscalls;
+			IODestroy(backends[i]);
+		}
+		free(backends);
+	}
+	bool succeed = true;
+	for (uint32_t k = 0; k < db->nshards; ++k) {
+		succeed = succeed && shards[k].succeed;
+	}
+	if (!succeed) {
+		free(shards);
+		return false;
+	}
+
+	ByteBuffer image = { };
+	DBManifest manifest = { db->header, db->nshards };
+	BBWrite(&image, &manifest, sizeof(DBManifest));
+	for (uint32_t k = 0; k < db->nshards; ++k) {
+		BBWrite(&image, &shards[k].generation, sizeof(uint64_t));
+	}
+	WriteStringPool(db->Strings, &image);
+	uint32_t info[2] = { db->HoldRecords->node_size, 0 };
+	for (TListNode *p = db->HoldRecords->head; p != NULL; p = p->next) {
+		++info[1];
+	}
+	BBWrite(&image, info, sizeof(info));
+	for (TListNode *p = db->HoldRecords->head; p != NULL; p = p->next) {
+		BBWrite(&image, p->data, db->HoldRecords->node_size);
+	}
+	DBMeta meta = { db->journal_lsn, archive_count, archive_bytes };
+	BBWrite(&image, &meta, sizeof(DBMeta));
+	AppendChecksums(&image);
+
+	char tmp[512];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+	succeed = fd >= 0 && IOWriteSync(db->IO, fd, image.data, image.size, 0);
+	if (fd >= 0) close(fd);
+	BBFree(&image);
+#ifdef _WIN32
+	if (succeed) remove(path);
+#endif
+	if (!succeed || rename(tmp, path) != 0) {
+		remove(tmp);
+		free(shards);
+		return false;
+	}
+	//! 嵥ЧձȡľɴƬ
+	for (uint32_t k = 0; inplace && k < db->nshards; ++k) {
+		if (shards[k].generation == db->ShardGenerations[k]) continue;
+		char old[512];
+		ShardPath(old, sizeof(old), path, k, db->ShardGenerations[k]);
+		remove(old);
+		db->ShardGenerations[k] = shards[k].generation;
+	}
+	if (inplace) db->dirty_shards = 0;
+	free(shards);
+	ExportBloomFilters(db, path);
+	ExportPopularity(db, path);
+	return true;
+}
+
+bool OpenLibraryDB(LibraryDB *db, const char *path, ThreadPool *workers) {
+	if (!db) return false;
+	db->Workers = workers;
+	if (access(path, F_OK) != 0) {
+		memset(&db->header, 0, sizeof(LibraryDBInfo));
+		db->header.account_rec_size = sizeof(AccountRecord);
+		db->header.book_rec_size = sizeof(BookRecord);
+		db->header.borrow_rec_size = sizeof(BorrowRecord);
+		db->header.version = LIBRARYDB_VERSION;
+		db->header.account_rec_num = 1;
+		db->header.next_account_id = 2;
+		db->AccountRecords = MakeTList(sizeof(AccountRecord));
+		db->BookRecords = MakeTList(sizeof(BookRecord));
+		db->BorrowRecords = MakeTList(sizeof(BorrowRecord));
+		db->HoldRecords = MakeTList(sizeof(HoldRecord));
+		db->BorrowHistory = OpenBorrowArchive(path);
+		db->Strings = MakeStringPool();
+
+		AccountRecord admin = { };
 		admin.group = Admin;
 		admin.id = 1;
 		strcpy(admin.account, "admin");
@@ -330,120 +4177,2396 @@ bool OpenLibraryDB(LibraryDB *db, const char *path) {
 		GetTimestamp(&admin.tm_register);
 		TLAppend(db->AccountRecords, &admin);
 
-		fclose(fp);
+		BuildAccountIndex(db);
+		BuildBookIndex(db);
+		BuildLoanIndex(db);
+		BuildHoldIndex(db);
+		BuildAccountFilter(db);
+		BuildBookFilter(db);
+		BuildPrefixTries(db);
+		db->Popularity = MakeHeavyHitters();
+		db->CoBorrow = MakeCoBorrowIndex();
+		InitShards(db);
+		//! д׸㣬־طпĿ
+		if (!ExportLibraryDB(db, path)) return false;
+	} else {
+		FILE *fp = fopen(path, "rb");
+		if (fp == NULL) return false;
+		DBManifest manifest = { };
+		bool succeed = fread(&db->header, sizeof(LibraryDBInfo), 1, fp) == 1;
+		if (succeed && db->header.version >= 6) {
+			succeed = fread(&manifest.nshards, sizeof(uint32_t), 2, fp) == 2
+				&& manifest.nshards >= 1 && manifest.nshards <= DB_MAX_SHARDS;
+			if (succeed) {
+				db->nshards = manifest.nshards;
+				db->ShardGenerations = (uint64_t*)calloc(db->nshards, sizeof(uint64_t));
+				succeed = fread(db->ShardGenerations, sizeof(uint64_t), db->nshards, fp) == db->nshards;
+			}
+		}
+		fclose(fp);
+		if (!succeed) return false;
+		db->AccountRecords = MakeTList(sizeof(AccountRecord));
+		db->BookRecords = MakeTList(sizeof(BookRecord));
+		db->BorrowRecords = MakeTList(sizeof(BorrowRecord));
+		db->HoldRecords = MakeTList(sizeof(HoldRecord));
+		db->BorrowHistory = OpenBorrowArchive(path);
+		db->Strings = MakeStringPool();
+		if (db->header.version > LIBRARYDB_VERSION) return false;
+
+		DBSection sections[4] = {
+			{ db, workers, path, db->AccountRecords, db->header.account_rec_size,
+				db->header.account_rec_num, 0, (TPTaskFn*)BuildAccountIndex },
+			{ db, workers, path, db->BookRecords, db->header.book_rec_size,
+				db->header.book_rec_num, 0, (TPTaskFn*)BuildBookIndex },
+			{ db, workers, path, db->BorrowRecords, db->header.borrow_rec_size,
+				db->header.borrow_rec_num, 0, (TPTaskFn*)BuildLoanIndex },
+			{ db, workers, path },
+		};
+		if (db->header.version == 0) {
+			sections[1].convert = (void*)ConvertBookRecordV0;
+		}
+		if (db->header.version < 2) {
+			sections[2].convert = (void*)ConvertBorrowRecordV1;
+		}
+		//! ֿУڼزн
+		ChecksumInfo checksums = { };
+		uint32_t *table = NULL;
+		size_t nparts = db->header.version >= 5 ? workers->nthreads : 0;
+		VerifyPart *parts = (VerifyPart*)calloc(nparts + 1, sizeof(VerifyPart));
+		if (nparts > 0) {
+			table = ReadChecksums(path, &checksums);
+			if (table == NULL) {
+				puts("ݿУ𻵣");
+				free(parts);
+				return false;
+			}
+			if (nparts > checksums.nblocks) nparts = checksums.nblocks;
+			SplitVerifyParts(parts, nparts, path, &checksums, table);
+			for (size_t i = 0; i < nparts; ++i) {
+				TPSubmit(workers, (TPTaskFn*)VerifyBlocks, &parts[i]);
+			}
+		}
+		SidecarFile sidecar = { db, path, 0 };
+		TPSubmit(workers, (TPTaskFn*)LoadBloomFilters, &sidecar);
+		TPSubmit(workers, (TPTaskFn*)LoadPopularity, &sidecar);
+		//! ƬУ飬ԭ˳鲢
+		DBShard *shards = (DBShard*)calloc(db->nshards, sizeof(DBShard));
+		for (uint32_t k = 0; k < db->nshards; ++k) {
+			shards[k].db = db;
+			shards[k].path = path;
+			shards[k].index = k;
+			shards[k].generation = db->ShardGenerations[k];
+			shards[k].accounts = MakeTList(sizeof(AccountRecord));
+			shards[k].books = MakeTList(sizeof(BookRecord));
+			shards[k].borrows = MakeTList(sizeof(BorrowRecord));
+			TPSubmit(workers, (TPTaskFn*)LoadShard, &shards[k]);
+		}
+		int64_t offset = db->nshards > 0 ? sizeof(DBManifest) + sizeof(uint64_t) * db->nshards : sizeof(LibraryDBInfo);
+		IORequest reads[3] = { };
+		for (int i = 0; i < 3 && db->nshards == 0; ++i) {
+			sections[i].offset = offset;
+			reads[i].size = sections[i].rec_size * sections[i].rec_num;
+			reads[i].offset = offset;
+			offset += reads[i].size;
+		}
+		//! ֧ύʱһζ룬ɸ̷ֱ߳λȡ
+		if (IOBatched(db->IO) && db->nshards == 0) {
+			int fd = open(path, O_RDONLY | O_BINARY);
+			for (int i = 0; i < 3; ++i) {
+				reads[i].data = reads[i].size > 0 ? malloc(reads[i].size) : NULL;
+			}
+			bool prefetched = fd >= 0 && IOReadBatch(db->IO, fd, reads, 3);
+			if (fd >= 0) close(fd);
+			for (int i = 0; i < 3; ++i) {
+				if (prefetched) {
+					sections[i].data = (char*)reads[i].data;
+				} else {
+					free(reads[i].data);
+				}
+			}
+		}
+		for (int i = 0; i < 3 && db->nshards == 0; ++i) {
+			TPSubmit(workers, (TPTaskFn*)LoadDBSection, &sections[i]);
+		}
+		sections[3].offset = offset;
+		sections[3].succeed = true;
+		if (db->header.version >= 1) {
+			TPSubmit(workers, (TPTaskFn*)LoadStringPoolSection, &sections[3]);
+		}
+		TPWait(workers);
+		VerifyPart damaged = { };
+		for (size_t i = 0; i < nparts; ++i) {
+			if (damaged.nbad == 0) damaged.first_bad = parts[i].first_bad;
+			damaged.nbad += parts[i].nbad;
+		}
+		if (damaged.nbad > 0) {
+			printf("ݿ%uУʧܣ%u𻵣\n", damaged.first_bad, damaged.nbad);
+			succeed = false;
+		}
+		free(parts);
+		free(table);
+		for (int i = 0; i < 4; ++i) {
+			succeed = succeed && (sections[i].succeed || (i < 3 && db->nshards > 0));
+		}
+		for (uint32_t k = 0; k < db->nshards; ++k) {
+			if (!shards[k].succeed && succeed) {
+				printf("ݷƬ%uȡʧܣ\n", k);
+				succeed = false;
+			}
+		}
+		if (succeed && db->nshards > 0) {
+			TList **lists = (TList**)malloc(db->nshards * sizeof(TList*));
+			for (uint32_t k = 0; k < db->nshards; ++k) lists[k] = shards[k].accounts;
+			TLMerge(db->AccountRecords, lists, db->nshards, AccountOrder);
+			for (uint32_t k = 0; k < db->nshards; ++k) lists[k] = shards[k].books;
+			TLMerge(db->BookRecords, lists, db->nshards, BookOrder);
+			for (uint32_t k = 0; k < db->nshards; ++k) lists[k] = shards[k].borrows;
+			TLMerge(db->BorrowRecords, lists, db->nshards, BorrowOrder);
+			free(lists);
+			for (int i = 0; i < 3; ++i) {
+				TPSubmit(workers, sections[i].indexer, db);
+			}
+			TPWait(workers);
+		}
+		for (uint32_t k = 0; k < db->nshards; ++k) {
+			TLDestroy(shards[k].accounts);
+			TLDestroy(shards[k].books);
+			TLDestroy(shards[k].borrows);
+			free(shards[k].accounts);
+			free(shards[k].books);
+			free(shards[k].borrows);
+		}
+		free(shards);
+		if (!succeed) return false;
+		if (db->header.version < 2) {
+			BFDestroy(db->BookFilter);
+			db->BookFilter = NULL;
+		}
+		//! ¼ͬһݿⲻùڵļ¼ᱻΪ
+		if ((db->AccountFilter != NULL || db->BookFilter != NULL) && sidecar.fingerprint != BloomFingerprint(db)) {
+			BFDestroy(db->AccountFilter);
+			BFDestroy(db->BookFilter);
+			db->AccountFilter = db->BookFilter = NULL;
+		}
+		if (db->AccountFilter == NULL) {
+			TPSubmit(workers, (TPTaskFn*)BuildAccountFilter, db);
+		}
+		if (db->BookFilter == NULL) {
+			TPSubmit(workers, (TPTaskFn*)BuildBookFilter, db);
+		}
+		PopularityBuild popularity = { db,
+			db->header.version == 0
+				|| db->header.book_rec_size < offsetof(BookRecord, borrow_count) + sizeof(uint32_t),
+			db->Popularity == NULL };
+		if (popularity.counters || popularity.windows) {
+			TPSubmit(workers, (TPTaskFn*)BuildPopularity, &popularity);
+		}
+		TPSubmit(workers, (TPTaskFn*)BuildPrefixTries, db);
+		DBSection holds = { db, workers, path, db->HoldRecords, sizeof(HoldRecord), 0,
+			sections[3].offset + sections[3].rec_size, (TPTaskFn*)BuildHoldIndex, NULL, true };
+		if (db->header.version >= 3) {
+			TPSubmit(workers, (TPTaskFn*)LoadHoldSection, &holds);
+		} else {
+			TPSubmit(workers, (TPTaskFn*)BuildHoldIndex, db);
+		}
+		CoBorrowBuild coborrow = { db, workers };
+		TPSubmit(workers, (TPTaskFn*)CollectCoBorrowEvents, &coborrow);
+		TPWait(workers);
+		BuildCoBorrowIndex(&coborrow);
+		if (!holds.succeed) return false;
+		if (db->header.version >= 4) {
+			DBMeta meta = { };
+			int fd = open(path, O_RDONLY | O_BINARY);
+			succeed = fd >= 0 && ReadAt(fd, &meta, sizeof(DBMeta),
+				holds.offset + (int64_t)holds.rec_size * holds.rec_num);
+			if (fd >= 0) close(fd);
+			if (!succeed) return false;
+			db->journal_lsn = meta.journal_lsn;
+			TrimBorrowArchive(db->BorrowHistory, meta.archive_count, meta.archive_bytes);
+		}
+		if (db->nshards == 0) InitShards(db);
+
+		if (db->header.next_account_id == 0) {
+			db->header.next_account_id = 2;
+		}
+		db->header.account_rec_size = sizeof(AccountRecord);
+		db->header.book_rec_size = sizeof(BookRecord);
+		db->header.borrow_rec_size = sizeof(BorrowRecord);
+		db->header.version = LIBRARYDB_VERSION;
+	}
+	db->Searches = MakeSearchCache(SC_MAX_ENTRIES, SC_MAX_BYTES);
+	return true;
+}
+
+void CloseLibraryDB(LibraryDB *db) {
+	TLDestroy(db->AccountRecords);
+	TLDestroy(db->BookRecords);
+	TLDestroy(db->BorrowRecords);
+	TLDestroy(db->HoldRecords);
+	HIDestroy(db->AccountIndex);
+	IDIDestroy(db->AccountIDIndex);
+	BFDestroy(db->AccountFilter);
+	BFDestroy(db->BookFilter);
+	CloseBorrowArchive(db->BorrowHistory);
+	free(db->Popularity);
+	CBDestroy(db->CoBorrow);
+	SCDestroy(db->Searches);
+	RTDestroy(db->ISBNTrie);
+	RTDestroy(db->TitleTrie);
+	HIDestroy(db->BookIndex);
+	HIDestroy(db->LoanIndex);
+	HIDestroy(db->AuthorIndex);
+	HIDestroy(db->Inbox);
+	if (db->HoldIndex != NULL) {
+		for (size_t i = 0; i < db->HoldIndex->capacity; ++i) {
+			HashEntry *entry = &db->HoldIndex->entries[i];
+			if (entry->ref != NULL && entry->ref != HI_TOMBSTONE) HQDestroy(entry->ref);
+		}
+	}
+	HIDestroy(db->HoldIndex);
+	SPDestroy(db->Strings);
+	free(db->ShardGenerations);
+	db->AccountRecords = NULL;
+	db->BookRecords = NULL;
+	db->BorrowRecords = NULL;
+	db->HoldRecords = NULL;
+	db->AccountIndex = NULL;
+	db->AccountIDIndex = NULL;
+	db->AccountFilter = NULL;
+	db->BookFilter = NULL;
+	db->BorrowHistory = NULL;
+	db->Popularity = NULL;
+	db->CoBorrow = NULL;
+	db->Searches = NULL;
+	db->ISBNTrie = NULL;
+	db->TitleTrie = NULL;
+	db->BookIndex = NULL;
+	db->LoanIndex = NULL;
+	db->AuthorIndex = NULL;
+	db->HoldIndex = NULL;
+	db->Inbox = NULL;
+	db->Strings = NULL;
+	db->ShardGenerations = NULL;
+	db->Workers = NULL;
+}
+
+/// ͳƱ
+//! Ƭۼƾֲͳһϲ
+typedef struct reportpart_s {
+	LibraryDB *db;
+	int table;
+	void **records;
+	size_t begin, end;
+	int32_t today;
+	Report partial;
+} ReportPart;
+
+static void RunReportPart(ReportPart *part) {
+	Report *report = &part->partial;
+	for (size_t i = part->begin; i < part->end; ++i) {
+		if (part->table == 0) {
+			AccountRecord *account = (AccountRecord*)part->records[i];
+			if (account->amount < 0) {
+				report->fines -= account->amount;
+				++report->debtors;
+			}
+		} else if (part->table == 1) {
+			BorrowRecord *loan = (BorrowRecord*)part->records[i];
+			if (report->items & ReportGroupLoans) {
+				AccountRecord *borrower = IDIFind(part->db->AccountIDIndex, loan->borrower_id);
+				if (borrower != NULL && borrower->group <= Admin) {
+					++report->group_loans[borrower->group];
+				}
+			}
+			if (part->today - GetDayNumber(&loan->tm_borrow) > (int64_t)loan->loan_time) {
+				++report->overdue;
+			}
+		} else {
+			BookRecord *book = (BookRecord*)part->records[i];
+			if (book->author < report->nauthors) {
+				report->author_stock[book->author] += book->stock;
+			}
+		}
+	}
+}
+
+void FreeReport(Report *report) {
+	if (!report) return;
+	free(report->author_stock);
+	free(report);
+}
+
+//! Ŀ˻ĿһηƬɨ
+Report* RunReport(LibraryDB *db, ThreadPool *pool, int items) {
+	Report *report = (Report*)calloc(1, sizeof(Report));
+	report->items = items;
+	report->nauthors = db->Strings->count;
+	report->author_stock = (uint64_t*)calloc(report->nauthors, sizeof(uint64_t));
+
+	TList *tables[3] = { NULL, NULL, NULL };
+	if (items & ReportFines) tables[0] = db->AccountRecords;
+	if (items & (ReportGroupLoans | ReportOverdue)) tables[1] = db->BorrowRecords;
+	if (items & ReportAuthorStock) tables[2] = db->BookRecords;
+
+	Timestamp now;
+	GetTimestamp(&now);
+	size_t nthreads = pool != NULL ? pool->nthreads : 1;
+	size_t nparts = 0, capacity = nthreads * 3;
+	ReportPart *parts = (ReportPart*)calloc(capacity, sizeof(ReportPart));
+	void **snapshots[3] = { NULL, NULL, NULL };
+	for (int table = 0; table < 3; ++table) {
+		if (tables[table] == NULL) continue;
+		size_t num = 0;
+		snapshots[table] = TLSnapshot(tables[table], &num);
+		for (size_t i = 0; i < nthreads; ++i) {
+			ReportPart *part = &parts[nparts++];
+			part->db = db;
+			part->table = table;
+			part->records = snapshots[table];
+			part->begin = num * i / nthreads;
+			part->end = num * (i + 1) / nthreads;
+			part->today = GetDayNumber(&now);
+			part->partial.items = items;
+			if (table == 2) {
+				part->partial.nauthors = report->nauthors;
+				part->partial.author_stock = (uint64_t*)calloc(report->nauthors, sizeof(uint64_t));
+			}
+		}
+	}
+	for (size_t i = 0; i < nparts; ++i) {
+		TPSubmit(pool, (TPTaskFn*)RunReportPart, &parts[i]);
+	}
+	TPWait(pool);
+
+	for (size_t i = 0; i < nparts; ++i) {
+		Report *partial = &parts[i].partial;
+		report->fines += partial->fines;
+		report->debtors += partial->debtors;
+		report->overdue += partial->overdue;
+		for (int group = User; group <= Admin; ++group) {
+			report->group_loans[group] += partial->group_loans[group];
+		}
+		for (uint32_t n = 0; partial->author_stock != NULL && n < report->nauthors; ++n) {
+			report->author_stock[n] += partial->author_stock[n];
+		}
+		free(partial->author_stock);
+	}
+	for (int table = 0; table < 3; ++table) {
+		free(snapshots[table]);
+	}
+	free(parts);
+	return report;
+}
+
+//! CSVֶһɼţֶڵ˫деĶŲ´
+static void PrintCSVField(FILE *fp, const char *field) {
+	fputc('"', fp);
+	for (const char *p = field; *p != '\0'; ++p) {
+		if (*p == '"') fputc('"', fp);
+		fputc(*p, fp);
+	}
+	fputc('"', fp);
+}
+
+static void PrintReportItem(FILE *fp, bool csv, const char *label, const char *value) {
+	if (!csv) {
+		fprintf(fp, " %s%s\n", label, value);
+		return;
+	}
+	PrintCSVField(fp, label);
+	fputc(',', fp);
+	PrintCSVField(fp, value);
+	fputc('\n', fp);
+}
+
+void PrintReport(Report *report, StringPool *strings, FILE *fp, bool csv) {
+	char value[64];
+	if (report->items & ReportFines) {
+		snprintf(value, sizeof(value), "%.2f", report->fines * 0.01);
+		PrintReportItem(fp, csv, "Ƿܶ", value);
+		snprintf(value, sizeof(value), "%u", report->debtors);
+		PrintReportItem(fp, csv, "Ƿ˻", value);
+	}
+	if (report->items & ReportGroupLoans) {
+		const char *groups[] = { [User] "ͨûڽ", [Manager] "Աڽ", [Admin] "Աڽ" };
+		for (int group = User; group <= Admin; ++group) {
+			snprintf(value, sizeof(value), "%u", report->group_loans[group]);
+			PrintReportItem(fp, csv, groups[group], value);
+		}
+	}
+	if (report->items & ReportOverdue) {
+		snprintf(value, sizeof(value), "%u", report->overdue);
+		PrintReportItem(fp, csv, "δ", value);
+	}
+	if (report->items & ReportAuthorStock) {
+		for (uint32_t n = 0; n < report->nauthors; ++n) {
+			if (report->author_stock[n] == 0) continue;
+			snprintf(value, sizeof(value), "%llu", (unsigned long long)report->author_stock[n]);
+			char label[128];
+			snprintf(label, sizeof(label), "ݲأ%s", SPGet(strings, n));
+			PrintReportItem(fp, csv, label, value);
+		}
+	}
+}
+
+bool ExportReport(Report *report, StringPool *strings, const char *path) {
+	FILE *fp = fopen(path, "w");
+	if (fp == NULL) return false;
+	PrintReport(report, strings, fp, true);
+	fclose(fp);
+	return true;
+}
+
+/// Ự
+//! ưƬеɷֲʱ
+#define SESSION_IDLE_SECONDS (30 * 60)
+
+static void TWInsert(TimerWheel *wheel, Session *session) {
+	int64_t delta = session->expire - wheel->now;
+	if (delta < 0) {
+		session->expire = wheel->now;
+		delta = 0;
+	}
+	int level = 0;
+	while (level + 1 < TW_LEVELS && delta >= (int64_t)1 << (TW_SLOT_BITS * (level + 1))) {
+		++level;
+	}
+	if (level + 1 == TW_LEVELS && delta >= (int64_t)1 << (TW_SLOT_BITS * TW_LEVELS)) {
+		session->expire = wheel->now + ((int64_t)1 << (TW_SLOT_BITS * TW_LEVELS)) - 1;
+	}
+	Session **bucket = &wheel->slots[level][(session->expire >> (TW_SLOT_BITS * level)) & (TW_SLOTS - 1)];
+	session->prev = NULL;
+	session->next = *bucket;
+	if (*bucket) (*bucket)->prev = session;
+	*bucket = session;
+	session->bucket = bucket;
+}
+
+static void TWRemove(Session *session) {
+	if (session->prev) session->prev->next = session->next; else *session->bucket = session->next;
+	if (session->next) session->next->prev = session->prev;
+	session->prev = session->next = NULL;
+	session->bucket = NULL;
+}
+
+//! ƽ߲λڵͲʱ·ţ̯O(1)
+static void TWAdvance(TimerWheel *wheel, int64_t now, void (*expire)(void *args, Session *session), void *args) {
+	while (wheel->now < now) {
+		++wheel->now;
+		for (int level = TW_LEVELS - 1; level > 0; --level) {
+			if (wheel->now & (((int64_t)1 << (TW_SLOT_BITS * level)) - 1)) continue;
+			Session **bucket = &wheel->slots[level][(wheel->now >> (TW_SLOT_BITS * level)) & (TW_SLOTS - 1)];
+			Session *p = *bucket;
+			*bucket = NULL;
+			while (p != NULL) {
+				Session *next = p->next;
+				TWInsert(wheel, p);
+				p = next;
+			}
+		}
+		Session **bucket = &wheel->slots[0][wheel->now & (TW_SLOTS - 1)];
+		Session *p = *bucket;
+		*bucket = NULL;
+		while (p != NULL) {
+			Session *next = p->next;
+			p->prev = p->next = NULL;
+			p->bucket = NULL;
+			expire(args, p);
+			p = next;
+		}
+	}
+}
+
+SessionManager* MakeSessionManager(uint32_t idle) {
+	SessionManager *manager = (SessionManager*)calloc(1, sizeof(SessionManager));
+	for (int i = 0; i < SM_STRIPES; ++i) {
+		pthread_mutex_init(&manager->stripes[i].lock, NULL);
+		manager->stripes[i].sessions = MakeHashIndex(0);
+	}
+	pthread_mutex_init(&manager->wheel_lock, NULL);
+	manager->wheel.now = time(NULL);
+	manager->idle = idle;
+	manager->seed = (uint64_t)time(NULL) ^ (uint64_t)(uintptr_t)manager << 16;
+	return manager;
+}
+
+static inline SessionStripe* SMStripe(SessionManager *manager, uint64_t token) {
+	return &manager->stripes[token & (SM_STRIPES - 1)];
+}
+
+static bool SessionTokenMatch(Session *session, uint64_t *token) {
+	return session->token == *token;
+}
+
+//! ǰзʵĻỰµǼ
+static void SMExpire(SessionManager *manager, Session *session) {
+	SessionStripe *stripe = SMStripe(manager, session->token);
+	pthread_mutex_lock(&stripe->lock);
+	if (session->deadline > manager->wheel.now) {
+		session->expire = session->deadline;
+		TWInsert(&manager->wheel, session);
+		pthread_mutex_unlock(&stripe->lock);
+		return;
+	}
+	HIErase(stripe->sessions, session->token >> 32, session);
+	pthread_mutex_unlock(&stripe->lock);
+	--manager->count;
+	free(session);
+}
+
+uint64_t SMOpen(SessionManager *manager, AccountRecord *host) {
+	Session *session = (Session*)calloc(1, sizeof(Session));
+	session->host_ref = host;
+	GetTimestamp(&session->tm_establish);
+	pthread_mutex_lock(&manager->wheel_lock);
+	do {
+		uint64_t z = (manager->seed += 0x9e3779b97f4a7c15ull);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		session->token = z ^ (z >> 31);
+	} while (session->token == 0);
+	session->deadline = session->expire = manager->wheel.now + manager->idle;
+	TWInsert(&manager->wheel, session);
+	++manager->count;
+	SessionStripe *stripe = SMStripe(manager, session->token);
+	pthread_mutex_lock(&stripe->lock);
+	HIInsert(stripe->sessions, session->token >> 32, session);
+	pthread_mutex_unlock(&stripe->lock);
+	pthread_mutex_unlock(&manager->wheel_lock);
+	return session->token;
+}
+
+//! ҲڣỰЧʱڸcopyЧѹڷfalse
+bool SMResolve(SessionManager *manager, uint64_t token, Session *copy) {
+	int64_t now = time(NULL);
+	if (pthread_mutex_trylock(&manager->wheel_lock) == 0) {
+		TWAdvance(&manager->wheel, now, (void(*)(void*, Session*))SMExpire, manager);
+		pthread_mutex_unlock(&manager->wheel_lock);
+	}
+	SessionStripe *stripe = SMStripe(manager, token);
+	pthread_mutex_lock(&stripe->lock);
+	Session *session = HIMatch(stripe->sessions, token >> 32, (TLMatchFn*)SessionTokenMatch, &token);
+	bool valid = session != NULL && session->deadline > now;
+	if (valid) {
+		session->deadline = now + manager->idle;
+		*copy = *session;
+		copy->prev = copy->next = NULL;
+		copy->bucket = NULL;
+	}
+	pthread_mutex_unlock(&stripe->lock);
+	return valid;
+}
+
+void SMClose(SessionManager *manager, uint64_t token) {
+	pthread_mutex_lock(&manager->wheel_lock);
+	SessionStripe *stripe = SMStripe(manager, token);
+	pthread_mutex_lock(&stripe->lock);
+	Session *session = HIMatch(stripe->sessions, token >> 32, (TLMatchFn*)SessionTokenMatch, &token);
+	if (session != NULL) {
+		HIErase(stripe->sessions, token >> 32, session);
+		TWRemove(session);
+		--manager->count;
+		free(session);
+	}
+	pthread_mutex_unlock(&stripe->lock);
+	pthread_mutex_unlock(&manager->wheel_lock);
+}
+
+//! ˻עرȫỰ
+void SMCloseAccount(SessionManager *manager, AccountRecord *host) {
+	pthread_mutex_lock(&manager->wheel_lock);
+	for (int i = 0; i < SM_STRIPES; ++i) {
+		SessionStripe *stripe = &manager->stripes[i];
+		pthread_mutex_lock(&stripe->lock);
+		HashIndex *index = stripe->sessions;
+		for (size_t slot = 0; slot < index->capacity; ++slot) {
+			Session *session = index->entries[slot].ref;
+			if (session == NULL || session == HI_TOMBSTONE || session->host_ref != host) continue;
+			HIErase(index, session->token >> 32, session);
+			TWRemove(session);
+			--manager->count;
+			free(session);
+		}
+		pthread_mutex_unlock(&stripe->lock);
+	}
+	pthread_mutex_unlock(&manager->wheel_lock);
+}
+
+void SMDestroy(SessionManager *manager) {
+	if (!manager) return;
+	for (int i = 0; i < SM_STRIPES; ++i) {
+		HashIndex *index = manager->stripes[i].sessions;
+		for (size_t slot = 0; slot < index->capacity; ++slot) {
+			Session *session = index->entries[slot].ref;
+			if (session != NULL && session != HI_TOMBSTONE) free(session);
+		}
+		HIDestroy(index);
+		pthread_mutex_destroy(&manager->stripes[i].lock);
+	}
+	pthread_mutex_destroy(&manager->wheel_lock);
+	free(manager);
+}
+
+/// Ựҵ
+bool AccountHashMatch(AccountRecord *record, AccountRecord *info) {
+	if (record->hashkey != info->hashkey) return false;
+	if (strcmp(record->account, info->account) != 0) return false;
+	return true;
+}
+
+bool ISBNMatch(BookRecord *record, uint64_t *isbn) {
+	return record->isbn == *isbn;
+}
+
+AccountRecord* FindAccount(LibraryDB *db, const char *account) {
+	AccountRecord info = { };
+	if (strlen(account) >= sizeof(info.account)) return NULL;
+	if (!BFMayContain(db->AccountFilter, hash64(account))) return NULL;
+	strcpy(info.account, account);
+	info.hashkey = hash(account);
+	return HIMatch(db->AccountIndex, info.hashkey, (TLMatchFn*)AccountHashMatch, &info);
+}
+
+AccountRecord* FindAccountByID(LibraryDB *db, uint32_t id) {
+	return IDIFind(db->AccountIDIndex, id);
+}
+
+//! 䣬ɰIDռõı
+uint32_t AllocAccountID(LibraryDB *db) {
+	while (db->header.next_account_id != 0
+		&& FindAccountByID(db, db->header.next_account_id) != NULL) {
+		++db->header.next_account_id;
+	}
+	if (db->header.next_account_id == 0) return 0;
+	return db->header.next_account_id++;
+}
+
+const char* BookName(LibraryDB *db, BookRecord *book) {
+	return SPGet(db->Strings, book->name);
+}
+
+const char* BookAuthor(LibraryDB *db, BookRecord *book) {
+	return SPGet(db->Strings, book->author);
+}
+
+BookRecord* FindBookByKey(LibraryDB *db, uint64_t isbn) {
+	if (!BFMayContain(db->BookFilter, ISBNHash64(isbn))) return NULL;
+	return HIMatch(db->BookIndex, ISBNHash(isbn), (TLMatchFn*)ISBNMatch, &isbn);
+}
+
+//! ַISBN-10/13дӰ
+BookRecord* FindBook(LibraryDB *db, const char *ISBN) {
+	return FindBookByKey(db, ISBNKey(ISBN));
+}
+
+bool ExclusiveLogin(LibrarySystem sys, const char *account, const char *password) {
+	AccountRecord *user = FindAccount(&sys->database, account);
+	if (!user) return false;
+	if (strcmp(user->password, password) != 0) return false;
+	if (sys->token != 0) {
+		SMClose(sys->sessions, sys->token);
+	}
+	sys->token = SMOpen(sys->sessions, user);
+	sys->session = SMResolve(sys->sessions, sys->token, &sys->current) ? &sys->current : NULL;
+	return true;
+}
+
+//! ±ʱɵ÷־طʱõͬ
+AccountRecord* DbRegister(LibraryDB *db, const char *account, const char *password, const Timestamp *tm) {
+	AccountRecord record = { };
+	if (strlen(account) >= sizeof(record.account) || strlen(password) >= sizeof(record.password)) return NULL;
+	if (FindAccount(db, account) != NULL) return NULL;
+	strcpy(record.account, account);
+	strcpy(record.password, password);
+	record.hashkey = hash(account);
+	record.group = User;
+	record.id = AllocAccountID(db);
+	record.amount = 0;
+	if (record.id == 0) return NULL;
+	record.tm_register = *tm;
+	AccountRecord *user = TLAppend(db->AccountRecords, &record);
+	HIInsert(db->AccountIndex, user->hashkey, user);
+	IDIInsert(db->AccountIDIndex, user->id, user);
+	BFInsert(db->AccountFilter, hash64(user->account));
+	++db->header.account_rec_num;
+	return user;
+}
+
+TListNode* FindReadyHold(LibraryDB *db, uint32_t patron_id, uint64_t isbn) {
+	TListNode *node = NULL;
+	size_t cursor = 0;
+	while ((node = HINext(db->Inbox, patron_id, &cursor)) != NULL) {
+		if (((HoldRecord*)node->data)->isbn == isbn) return node;
+	}
+	return NULL;
+}
+
+//! ԤԼУŶλΣڶлѵʱ0
+int PlaceHold(LibraryDB *db, BookRecord *book, uint32_t patron_id, const Timestamp *tm) {
+	HoldQueue *queue = FindHoldQueue(db, book->isbn, true);
+	for (uint32_t i = 0; i < queue->size; ++i) {
+		if (((HoldRecord*)HQAt(queue, i)->data)->patron_id == patron_id) return 0;
+	}
+	if (FindReadyHold(db, patron_id, book->isbn) != NULL) return 0;
+	HoldRecord record = { };
+	record.isbn = book->isbn;
+	record.patron_id = patron_id;
+	record.tm_reserve = *tm;
+	record.tm_ready.year = -1;
+	TLAppend(db->HoldRecords, &record);
+	HQPush(queue, db->HoldRecords->tail);
+	return queue->size;
+}
+
+//! һ黹ĸԤԼ˲Ͷݵ֪ͨ˵ȺʱNULL
+AccountRecord* ServeHold(LibraryDB *db, BookRecord *book, const Timestamp *tm) {
+	HoldQueue *queue = FindHoldQueue(db, book->isbn, false);
+	TListNode *node = NULL;
+	while (queue != NULL && (node = HQPop(queue)) != NULL) {
+		HoldRecord *record = (HoldRecord*)node->data;
+		AccountRecord *patron = FindAccountByID(db, record->patron_id);
+		if (patron != NULL) {
+			record->tm_ready = *tm;
+			HIInsert(db->Inbox, record->patron_id, node);
+			return patron;
+		}
+		TLErase(db->HoldRecords, node);
+		free(record);
+		free(node);
+	}
+	return NULL;
+}
+
+//! ԤԼ˽߱ƳԤԼ
+void TakeHold(LibraryDB *db, TListNode *node) {
+	HoldRecord *record = (HoldRecord*)node->data;
+	HIErase(db->Inbox, record->patron_id, node);
+	TLErase(db->HoldRecords, node);
+	free(record);
+	free(node);
+}
+
+//! ݱĸһλԤԼˣ˵ȺʱŻش
+void ReleaseHold(LibraryDB *db, TListNode *node, const Timestamp *tm) {
+	uint64_t isbn = ((HoldRecord*)node->data)->isbn;
+	TakeHold(db, node);
+	BookRecord *book = FindBookByKey(db, isbn);
+	if (book == NULL) return;
+	if (ServeHold(db, book, tm) == NULL) {
+		++book->stock;
+		SCInvalidateRow(db->Searches, book);
+	}
+	// the book may not be named by the mutation being applied
+	if (db->nshards > 0) db->dirty_shards |= 1ull << BookShard(db, isbn);
+}
+
+//! ݱHOLD_KEEP_DAYSԤԼϣʱÿһΣ־طʱͬ
+void ExpireHolds(LibraryDB *db, const Timestamp *tm) {
+	int32_t today = GetDayNumber(tm);
+	if (today <= db->hold_day) return;
+	db->hold_day = today;
+	size_t count = 0, capacity = 4;
+	TListNode **expired = (TListNode**)malloc(capacity * sizeof(TListNode*));
+	for (TListNode *p = db->HoldRecords->head; p != NULL; p = p->next) {
+		HoldRecord *record = (HoldRecord*)p->data;
+		if (record->tm_ready.year == -1 || today - GetDayNumber(&record->tm_ready) <= HOLD_KEEP_DAYS) continue;
+		if (count == capacity) {
+			capacity *= 2;
+			expired = (TListNode**)realloc(expired, capacity * sizeof(TListNode*));
+		}
+		expired[count++] = p;
+	}
+	for (size_t i = 0; i < count; ++i) {
+		ReleaseHold(db, expired[i], tm);
+	}
+	free(expired);
+}
+
+//! нĻǷѵ˻עȺеԤԼϣѵݵıתŻش
+bool DbCancel(LibraryDB *db, AccountRecord *target, const Timestamp *tm) {
+	size_t cursor = 0;
+	if (target->id == 1 || target->amount < 0) return false;
+	if (HINext(db->LoanIndex, target->id, &cursor) != NULL) return false;
+	TListNode *node = TLFind(db->AccountRecords, target, true);
+	if (!TLErase(db->AccountRecords, node)) return false;
+	HIErase(db->AccountIndex, target->hashkey, target);
+	IDIErase(db->AccountIDIndex, target->id, target);
+	--db->header.account_rec_num;
+	//! ռٴתʱServeHoldڵ
+	size_t count = 0, capacity = 4;
+	TListNode **holds = (TListNode**)malloc(capacity * sizeof(TListNode*));
+	for (TListNode *p = db->HoldRecords->head; p != NULL; p = p->next) {
+		if (((HoldRecord*)p->data)->patron_id != target->id) continue;
+		if (count == capacity) {
+			capacity *= 2;
+			holds = (TListNode**)realloc(holds, capacity * sizeof(TListNode*));
+		}
+		holds[count++] = p;
+	}
+	for (size_t i = 0; i < count; ++i) {
+		HoldRecord *record = (HoldRecord*)holds[i]->data;
+		if (record->tm_ready.year != -1) {
+			ReleaseHold(db, holds[i], tm);
+			continue;
+		}
+		HoldQueue *queue = FindHoldQueue(db, record->isbn, false);
+		if (queue != NULL) HQRemove(queue, holds[i]);
+		TLErase(db->HoldRecords, holds[i]);
+		free(record);
+		free(holds[i]);
+	}
+	free(holds);
+	//! ע븱Ӧ־˴Ựڼ¼ͷǰر
+	if (db->cancel_hook != NULL) db->cancel_hook(db->cancel_args, target);
+	free(node);
+	return true;
+}
+
+//! 黹Ĳ鵵
+int ReturnBook(LibraryDB *db, TListNode *node, const Timestamp *tm) {
+	BorrowRecord *record = (BorrowRecord*)node->data;
+	AccountRecord *borrower = FindAccountByID(db, record->borrower_id);
+	BookRecord *book = FindBookByKey(db, record->isbn);
+	record->tm_return = *tm;
+	double diff = GetDuration(&record->tm_borrow, &record->tm_return);
+	int overdue = (int)(diff / 86400) - (int)record->loan_time;
+	if (overdue > 0 && borrower != NULL) {
+		borrower->amount -= overdue * 0.3 * 100; // 060.3/day
+	}
+	if (book != NULL && ServeHold(db, book, tm) == NULL) {
+		++book->stock;
+		SCInvalidateRow(db->Searches, book);
+	}
+	HIErase(db->LoanIndex, record->borrower_id, node);
+	if (TLErase(db->BorrowRecords, node)) {
+		--db->header.borrow_rec_num;
+	}
+	ArchiveBorrowRecord(db->BorrowHistory, record);
+	free(record);
+	free(node);
+	return overdue;
+}
+
+//! ˡĿʱ䶨λδ黹
+TListNode* FindLoan(LibraryDB *db, uint32_t borrower_id, uint64_t isbn, const Timestamp *tm_borrow) {
+	TListNode *node = NULL;
+	size_t cursor = 0;
+	uint64_t packed = PackTimestamp(tm_borrow);
+	while ((node = HINext(db->LoanIndex, borrower_id, &cursor)) != NULL) {
+		BorrowRecord *record = (BorrowRecord*)node->data;
+		if (record->isbn == isbn && PackTimestamp(&record->tm_borrow) == packed) return node;
+	}
+	return NULL;
+}
+
+//! ޴޵ԤԼʱʧܣѱʱԤԼ
+bool DbBorrow(LibraryDB *db, AccountRecord *patron, BookRecord *book, uint32_t loan_time, const Timestamp *tm) {
+	TListNode *hold = FindReadyHold(db, patron->id, book->isbn);
+	if (loan_time == 0 || (book->stock == 0 && hold == NULL)) return false;
+	BorrowRecord record = { };
+	record.isbn = book->isbn;
+	record.loan_time = loan_time;
+	record.borrower_id = patron->id;
+	record.tm_borrow = *tm;
+	record.tm_return.year = -1; // unreturned mark
+	TLAppend(db->BorrowRecords, &record);
+	HIInsert(db->LoanIndex, record.borrower_id, db->BorrowRecords->tail);
+	++db->header.borrow_rec_num;
+	if (hold != NULL) {
+		TakeHold(db, hold);
+	} else {
+		--book->stock;
+		SCInvalidateRow(db->Searches, book);
+	}
+	++book->borrow_count;
+	HHRecord(db->Popularity, book->isbn, GetDayNumber(tm));
+	CBRecord(db->CoBorrow, record.borrower_id, book, ISBNHash(book->isbn));
+	return true;
+}
+
+//! 򲹳ĿĸȽԤԼˣΪԤԼıϢͻʱ-1
+int DbAddBook(LibraryDB *db, const char *ISBN, const char *name, const char *author, int number, const Timestamp *tm) {
+	uint64_t isbn = ParseISBN(ISBN);
+	if (isbn == 0 || number <= 0) return -1;
+	BookRecord *book = FindBookByKey(db, isbn);
+	StringPool *strings = db->Strings;
+	if (book != NULL) {
+		if (book->name != SPLookup(strings, name) || book->author != SPLookup(strings, author)) return -1;
+		int served = 0;
+		while (served < number && ServeHold(db, book, tm) != NULL) {
+			++served;
+		}
+		book->stock += number - served;
+		SCInvalidateRow(db->Searches, book);
+		return served;
+	}
+	BookRecord record = { };
+	if (strlen(ISBN) < sizeof(record.ISBN)) {
+		strcpy(record.ISBN, ISBN);
+	} else {
+		NormalizeISBN(ISBN, record.ISBN, sizeof(record.ISBN));
+	}
+	record.isbn = isbn;
+	record.name = SPIntern(strings, name);
+	record.author = SPIntern(strings, author);
+	record.stock = number;
+	record.tm_introduce = *tm;
+	book = TLAppend(db->BookRecords, &record);
+	HIInsert(db->BookIndex, ISBNHash(book->isbn), book);
+	HIInsert(db->AuthorIndex, book->author, book);
+	SCInvalidateInsert(db->Searches, book->isbn, name, author);
+	RTInsertISBN(db->ISBNTrie, book);
+	RTInsert(db->TitleTrie, SPKey(strings, book->name), book);
+	BFInsert(db->BookFilter, ISBNHash64(book->isbn));
+	++db->header.book_rec_num;
+	return 0;
+}
+
+#define COMPLETE_MAX 10
+
+static bool BookNameMatched(BookRecord *book, uint8_t *matched) {
+	return matched[book->name];
+}
+
+//! Ŀ黺УһμǰЧ
+//! ޶δʱownedΪtrueɵ÷ͷ
+BookRecord** SearchBooks(LibraryDB *db, int field, const char *pattern, size_t *num, bool *owned) {
+	//! ߰棬Сдȫ㲻ͬ빲Ŀ
+	char key[256];
+	if (field != SearchISBN) pattern = SearchKey(pattern, key, sizeof(key));
+	void **results = SCGet(db->Searches, field, pattern, num);
+	*owned = false;
+	if (results != NULL) return (BookRecord**)results;
+	size_t count = 0, capacity = 16;
+	results = (void**)malloc(capacity * sizeof(void*));
+	if (field == SearchISBN) {
+		BookRecord *book = FindBook(db, pattern);
+		if (book != NULL) {
+			results[count++] = book;
+		}
+	} else {
+		uint8_t *matched = SPMatchAll(db->Strings, pattern);
+		if (field == SearchName) {
+			free(results);
+			results = TLParallelScan(db->BookRecords, db->Workers, (TLMatchFn*)BookNameMatched, matched, 0, &count);
+		} else {
+			for (uint32_t author = 0; author < db->Strings->count; ++author) {
+				if (!matched[author]) continue;
+				BookRecord *book = NULL;
+				size_t cursor = 0;
+				while ((book = HINext(db->AuthorIndex, author, &cursor)) != NULL) {
+					if (count == capacity) {
+						capacity *= 2;
+						results = (void**)realloc(results, capacity * sizeof(void*));
+					}
+					results[count++] = book;
+				}
+			}
+		}
+		free(matched);
+	}
+	void **cached = SCPut(db->Searches, field, pattern, results, count);
+	if (cached == NULL) {
+		*owned = true;
+		cached = results;
+	} else {
+		free(results);
+	}
+	*num = count;
+	return (BookRecord**)cached;
+}
+
+//! ISBNǰ׺ȫеַʡ
+size_t CompleteISBN(LibraryDB *db, const char *prefix, BookRecord **results, size_t max) {
+	char key[64];
+	NormalizeISBN(prefix, key, sizeof(key));
+	return RTComplete(db->ISBNTrie, key, (void**)results, max);
+}
+
+//! ǰ׺ȫ
+size_t CompleteTitle(LibraryDB *db, const char *prefix, BookRecord **results, size_t max) {
+	char key[256];
+	NormalizeText(prefix, key, sizeof(key));
+	return RTComplete(db->TitleTrie, key, (void**)results, max);
+}
+
+//! ȷʧʱΪǰ׺ȫΨһѡΪ
+//! ǰ׺ȫΪISBNַʱȫISBNȫ
+size_t CompleteBooks(LibraryDB *db, const char *prefix, BookRecord **results, size_t max) {
+	char key[64];
+	size_t len = NormalizeISBN(prefix, key, sizeof(key));
+	if (len > 0 && strspn(key, "0123456789X") == len) {
+		return CompleteISBN(db, prefix, results, max);
+	}
+	return CompleteTitle(db, prefix, results, max);
+}
+
+//! ȷʧʱǰ׺ȫcandidatesCOMPLETE_MAXnumغѡȷʱΪ0
+//! ΨһѡΪУɵ÷ʾǷҪȷ
+BookRecord* ResolveBook(LibraryDB *db, const char *ISBN, BookRecord **candidates, size_t *num) {
+	BookRecord *book = FindBook(db, ISBN);
+	*num = 0;
+	if (book != NULL || ISBN[0] == '\0') return book;
+	*num = CompleteISBN(db, ISBN, candidates, COMPLETE_MAX);
+	return *num == 1 ? candidates[0] : NULL;
+}
+
+int GetLoanNum(LibraryDB *db, uint32_t id) {
+	size_t cursor = 0;
+	int count = 0;
+	while (HINext(db->LoanIndex, id, &cursor) != NULL) {
+		++count;
+	}
+	return count;
+}
+
+int GetBorrowNum(LibrarySystem sys) {
+	if (sys->session == NULL) return 0;
+	return GetLoanNum(&sys->database, sys->session->host_ref->id);
+}
+
+/// ־
+//! Ӧڴ׷<path>.walύ߳̽ͬһκϲΪһдͬ
+//! ־[u32 ][u32 У][varintУ  ˻ ISBN ֵ ʱ οʱ ı]
+#define JOURNAL_MAX_WAIT_US 1000
+#define JOURNAL_BATCH_BYTES (64 << 10)
+
+static uint32_t JournalCheck(const uint8_t *data, size_t size) {
+	uint32_t check = 0x811c9dc5;
+	for (size_t i = 0; i < size; ++i) {
+		check = (check ^ data[i]) * 0x01000193;
+	}
+	return check;
+}
+
+static bool GetVarint(const uint8_t **p, const uint8_t *end, uint64_t *value) {
+	*value = 0;
+	for (int shift = 0; *p < end && shift < 64; shift += 7) {
+		uint8_t byte = *(*p)++;
+		*value |= (uint64_t)(byte & 0x7f) << shift;
+		if (!(byte & 0x80)) return true;
+	}
+	return false;
+}
+
+static void EncodeMutation(ByteBuffer *buffer, uint64_t lsn, const Mutation *m) {
+	ByteBuffer payload = { };
+	BBPutVarint(&payload, lsn);
+	BBPutVarint(&payload, m->op);
+	BBPutVarint(&payload, m->id);
+	BBPutVarint(&payload, m->isbn);
+	BBPutVarint(&payload, ZigZag(m->value));
+	BBPutVarint(&payload, PackTimestamp(&m->tm));
+	BBPutVarint(&payload, PackTimestamp(&m->tm_ref));
+	for (int i = 0; i < 3; ++i) {
+		size_t len = strnlen(m->text[i], sizeof(m->text[i]) - 1);
+		BBPutVarint(&payload, len);
+		BBWrite(&payload, m->text[i], len);
+	}
+	uint32_t head[2] = { (uint32_t)payload.size, JournalCheck(payload.data, payload.size) };
+	BBWrite(buffer, head, sizeof(head));
+	BBWrite(buffer, payload.data, payload.size);
+	BBFree(&payload);
+}
+
+static bool DecodeMutation(const uint8_t *p, const uint8_t *end, uint64_t *lsn, Mutation *m) {
+	uint64_t op, id, isbn, value, tm, tm_ref;
+	memset(m, 0, sizeof(Mutation));
+	if (!GetVarint(&p, end, lsn) || !GetVarint(&p, end, &op) || !GetVarint(&p, end, &id)) return false;
+	if (!GetVarint(&p, end, &isbn) || !GetVarint(&p, end, &value)) return false;
+	if (!GetVarint(&p, end, &tm) || !GetVarint(&p, end, &tm_ref)) return false;
+	for (int i = 0; i < 3; ++i) {
+		uint64_t len;
+		if (!GetVarint(&p, end, &len) || len >= sizeof(m->text[i]) || len > (uint64_t)(end - p)) return false;
+		memcpy(m->text[i], p, len);
+		p += len;
+	}
+	m->op = op;
+	m->id = id;
+	m->isbn = isbn;
+	m->value = UnZigZag(value);
+	UnpackTimestamp(&m->tm, tm);
+	UnpackTimestamp(&m->tm_ref, tm_ref);
+	return p == end;
+}
+
+//! ύ̣߳ȴдʱ
+static void* JournalCommitter(void *args) {
+	Journal *log = (Journal*)args;
+	pthread_mutex_lock(&log->lock);
+	while (true) {
+		while (!log->shutdown && log->pending.size == 0) {
+			pthread_cond_wait(&log->wake, &log->lock);
+		}
+		if (log->pending.size == 0) break;
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += (long)log->max_wait_us * 1000;
+		deadline.tv_sec += deadline.tv_nsec / 1000000000;
+		deadline.tv_nsec %= 1000000000;
+		while (!log->shutdown && log->pending.size < JOURNAL_BATCH_BYTES
+			&& pthread_cond_timedwait(&log->wake, &log->lock, &deadline) == 0) {}
+		ByteBuffer batch = log->pending;
+		uint64_t lsn = log->appended_lsn;
+		JournalShipFn *ship = log->ship;
+		void *ship_args = log->ship_args;
+		memset(&log->pending, 0, sizeof(ByteBuffer));
+		pthread_mutex_unlock(&log->lock);
+		bool succeed = !log->failed && IOWriteSync(log->io, log->fd, batch.data, batch.size, log->offset);
+		log->offset += batch.size;
+		if (succeed && ship != NULL) ship(ship_args, batch.data, batch.size, lsn);
+		BBFree(&batch);
+		pthread_mutex_lock(&log->lock);
+		if (succeed) {
+			log->durable_lsn = lsn;
+		} else {
+			log->failed = true; // the log may be torn from here on
+		}
+		++log->batches;
+		pthread_cond_broadcast(&log->flushed);
+	}
+	pthread_mutex_unlock(&log->lock);
+	return NULL;
+}
+
+Journal* OpenJournal(const char *path, uint32_t max_wait_us) {
+	char buf[512];
+	snprintf(buf, sizeof(buf), "%s.wal", path);
+	int fd = open(buf, O_WRONLY | O_CREAT | O_BINARY, 0644);
+	if (fd < 0) return NULL;
+	Journal *log = (Journal*)calloc(1, sizeof(Journal));
+	log->fd = fd;
+	log->offset = lseek(fd, 0, SEEK_END);
+	log->io = MakeIOBackend();
+	log->max_wait_us = max_wait_us;
+	pthread_mutex_init(&log->lock, NULL);
+	pthread_cond_init(&log->wake, NULL);
+	pthread_cond_init(&log->flushed, NULL);
+	pthread_create(&log->committer, NULL, JournalCommitter, log);
+	return log;
+}
+
+//! ſδ̵κر
+void CloseJournal(Journal *log) {
+	if (!log) return;
+	pthread_mutex_lock(&log->lock);
+	log->shutdown = true;
+	pthread_cond_signal(&log->wake);
+	pthread_mutex_unlock(&log->lock);
+	pthread_join(log->committer, NULL);
+	close(log->fd);
+	IODestroy(log->io);
+	BBFree(&log->pending);
+	pthread_mutex_destroy(&log->lock);
+	pthread_cond_destroy(&log->wake);
+	pthread_cond_destroy(&log->flushed);
+	free(log);
+}
+
+void JournalAppend(Journal *log, uint64_t lsn, const Mutation *m) {
+	pthread_mutex_lock(&log->lock);
+	size_t size = log->pending.size;
+	EncodeMutation(&log->pending, lsn, m);
+	log->appended_lsn = lsn;
+	++log->entries;
+	if (size == 0 || log->pending.size >= JOURNAL_BATCH_BYTES) {
+		pthread_cond_signal(&log->wake);
+	}
+	pthread_mutex_unlock(&log->lock);
+}
+
+//! ȴlsn
+bool JournalWait(Journal *log, uint64_t lsn) {
+	pthread_mutex_lock(&log->lock);
+	while (log->durable_lsn < lsn && !log->failed) {
+		pthread_cond_wait(&log->flushed, &log->lock);
+	}
+	bool durable = log->durable_lsn >= lsn;
+	pthread_mutex_unlock(&log->lock);
+	return durable;
+}
+
+//! ֮־ԭΪ<path>.wal.old߳п־ọ̈̄
+//! ʱΣύ߳Ҳٷдλ
+bool JournalReset(Journal *log, const char *path) {
+	char wal[512], old[512];
+	snprintf(wal, sizeof(wal), "%s.wal", path);
+	snprintf(old, sizeof(old), "%s.wal.old", path);
+	pthread_mutex_lock(&log->lock);
+	bool succeed = log->pending.size == 0 && !log->failed && DuplicateFile(wal, old) && TruncateFile(wal, 0);
+	if (succeed) log->offset = 0;
+	pthread_mutex_unlock(&log->lock);
+	return succeed;
+}
+
+//! Ψһִڣ־ط߷
+static bool DbDispatch(LibraryDB *db, Mutation *m) {
+	AccountRecord *account = m->id != 0 ? FindAccountByID(db, m->id) : NULL;
+	BookRecord *book = m->isbn != 0 ? FindBookByKey(db, m->isbn) : NULL;
+	m->result = 0;
+	switch (m->op) {
+		case OpRegister: {
+			AccountRecord *user = DbRegister(db, m->text[0], m->text[1], &m->tm);
+			m->result = user != NULL ? user->id : 0;
+			return user != NULL;
+		}
+		case OpCancel: {
+			return account != NULL && DbCancel(db, account, &m->tm);
+		}
+		case OpResetPassword: {
+			if (account == NULL || account->id == 1) return false;
+			if (strlen(m->text[0]) >= sizeof(account->password)) return false;
+			strcpy(account->password, m->text[0]);
+			return true;
+		}
+		case OpRecharge: {
+			if (account == NULL || m->value <= 0) return false;
+			account->amount += m->value;
+			return true;
+		}
+		case OpAddBook: {
+			m->result = DbAddBook(db, m->text[0], m->text[1], m->text[2], m->value, &m->tm);
+			return m->result >= 0;
+		}
+		case OpBorrow: {
+			return account != NULL && book != NULL && m->value > 0
+				&& DbBorrow(db, account, book, m->value, &m->tm);
+		}
+		case OpReturn: {
+			TListNode *node = FindLoan(db, m->id, m->isbn, &m->tm_ref);
+			if (node == NULL) return false;
+			m->result = ReturnBook(db, node, &m->tm);
+			return true;
+		}
+		case OpReserve: {
+			if (account == NULL || book == NULL) return false;
+			m->result = PlaceHold(db, book, account->id, &m->tm);
+			return m->result > 0;
+		}
+	}
+	return false;
+}
+
+static bool DbApply(LibraryDB *db, Mutation *m) {
+	if (!DbDispatch(db, m)) return false;
+	ExpireHolds(db, &m->tm);
+	MarkShardsDirty(db, m);
+	return true;
+}
+
+//! Ӧñ׷־ȴڼ䲻
+bool Mutate(LibraryDB *db, Mutation *m) {
+	uint64_t lsn = 0;
+	pthread_mutex_lock(&db->lock);
+	bool applied = DbApply(db, m);
+	if (applied && db->Log != NULL) {
+		lsn = ++db->journal_lsn;
+		JournalAppend(db->Log, lsn, m);
+	}
+	pthread_mutex_unlock(&db->lock);
+	m->durable = lsn != 0 && JournalWait(db->Log, lsn);
+	return applied;
+}
+
+//! offset־ǰƣȱ򵽴ĩβʱfalse
+static bool NextJournalEntry(const uint8_t *data, size_t size, size_t *offset, uint64_t *lsn, Mutation *m) {
+	if (*offset + 8 > size) return false;
+	uint32_t head[2];
+	memcpy(head, data + *offset, sizeof(head));
+	if (head[0] > size - *offset - 8) return false;
+	const uint8_t *payload = data + *offset + 8;
+	if (JournalCheck(payload, head[0]) != head[1]) return false;
+	if (!DecodeMutation(payload, payload + head[0], lsn, m)) return false;
+	*offset += 8 + head[0];
+	return true;
+}
+
+//! ӦӦŵ־òֵĳ
+static size_t ApplyJournalEntries(LibraryDB *db, const uint8_t *data, size_t size, int *applied) {
+	size_t offset = 0;
+	uint64_t lsn;
+	Mutation m;
+	while (NextJournalEntry(data, size, &offset, &lsn, &m)) {
+		if (lsn <= db->journal_lsn) continue;
+		DbApply(db, &m);
+		db->journal_lsn = lsn;
+		++*applied;
+	}
+	return offset;
+}
+
+//! ־ļļȱʧΪʱNULL
+static uint8_t* LoadJournalFile(const char *path, size_t *size) {
+	*size = 0;
+	FILE *fp = fopen(path, "rb");
+	if (fp == NULL) return NULL;
+	fseek(fp, 0, SEEK_END);
+	long length = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	uint8_t *data = length > 0 ? (uint8_t*)malloc(length) : NULL;
+	if (data != NULL && fread(data, 1, length, fp) == (size_t)length) {
+		*size = length;
+	}
+	fclose(fp);
+	return data;
+}
+
+//! طſ֮־׸ȱضϣطĿ
+int ReplayJournal(LibraryDB *db, const char *path) {
+	char buf[512];
+	snprintf(buf, sizeof(buf), "%s.wal", path);
+	size_t size = 0;
+	uint8_t *data = LoadJournalFile(buf, &size);
+	int replayed = 0;
+	size_t offset = ApplyJournalEntries(db, data, size, &replayed);
+	free(data);
+	if (offset < size) {
+		TruncateFile(buf, offset);
+	}
+	return replayed;
+}
+
+/// ־
+//! ⽫̵־ξ׽͸ֻ𲽺Ӧ
+//! ֡ReplFramesizeֽڸأ־<path>.walʽͬȥ
+#define REPL_HEARTBEAT_MS 1000
+#define REPL_SEND_TIMEOUT_S 5
+
+#ifndef _WIN32
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static bool SendAll(int fd, const void *data, size_t size) {
+	const char *p = (const char*)data;
+	while (size > 0) {
+		ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+		if (n <= 0) return false;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+static bool RecvAll(int fd, void *data, size_t size) {
+	char *p = (char*)data;
+	while (size > 0) {
+		ssize_t n = recv(fd, p, size, 0);
+		if (n <= 0) return false;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+static bool SendFrame(int fd, uint32_t type, uint64_t lsn, int64_t stamp_us, const void *data, size_t size) {
+	ReplFrame frame = { type, (uint32_t)size, lsn, stamp_us };
+	return SendAll(fd, &frame, sizeof(ReplFrame)) && (size == 0 || SendAll(fd, data, size));
+}
+
+//! ֵַΪTCP˿ڣΪUnix׽·
+static int ReplicaSocket(const char *address, bool listening) {
+	bool tcp = address[0] != '\0' && strspn(address, "0123456789") == strlen(address);
+	int fd = socket(tcp ? AF_INET : AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	bool succeed;
+	if (tcp) {
+		struct sockaddr_in addr = { };
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons((uint16_t)atoi(address));
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		int reuse = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+		succeed = listening
+			? bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0 && listen(fd, REPL_MAX_LINKS) == 0
+			: connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0;
 	} else {
-		FILE *fp = fopen(path, "rb");
-		if (fp == NULL) return false;
-		fread(&db->header, sizeof(LibraryDBInfo), 1, fp);
-		db->AccountRecords = MakeTList(sizeof(AccountRecord));
-		db->BookRecords = MakeTList(sizeof(BookRecord));
-		db->BorrowRecords = MakeTList(sizeof(BorrowRecord));
-		for (int n = 0, size = db->header.account_rec_size; n < db->header.account_rec_num; ++n) {
-			AccountRecord record;
-			fread(&record, size, 1, fp);
-			TLAppend(db->AccountRecords, &record);
+		struct sockaddr_un addr = { };
+		addr.sun_family = AF_UNIX;
+		succeed = strlen(address) < sizeof(addr.sun_path);
+		if (succeed) {
+			strcpy(addr.sun_path, address);
+			if (listening) unlink(address);
+			succeed = listening
+				? bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0 && listen(fd, REPL_MAX_LINKS) == 0
+				: connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+		}
+	}
+	if (!succeed) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+//! ύ̺߳ãƵͻ壬ȴ
+static void HubPublish(ReplicaHub *hub, const uint8_t *data, size_t size, uint64_t lsn) {
+	pthread_mutex_lock(&hub->lock);
+	bool idle = hub->pending.size == 0;
+	BBWrite(&hub->pending, data, size);
+	hub->published_lsn = lsn;
+	pthread_mutex_unlock(&hub->lock);
+	if (idle) {
+		char signal = 1;
+		write(hub->wake[1], &signal, 1);
+	}
+}
+
+static void HubDrop(ReplicaHub *hub, uint32_t index) {
+	pthread_mutex_lock(&hub->lock);
+	close(hub->links[index].fd);
+	hub->links[index] = hub->links[--hub->nlinks];
+	pthread_mutex_unlock(&hub->lock);
+}
+
+static void HubAccept(ReplicaHub *hub) {
+	int fd = accept(hub->listen_fd, NULL, NULL);
+	if (fd < 0) return;
+	struct timeval timeout = { REPL_SEND_TIMEOUT_S, 0 };
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+	pthread_mutex_lock(&hub->lock);
+	uint64_t lsn = hub->published_lsn;
+	bool full = hub->nlinks == REPL_MAX_LINKS;
+	pthread_mutex_unlock(&hub->lock);
+	if (full || !SendFrame(fd, ReplHello, lsn, GetMicroseconds(), hub->db_path, strlen(hub->db_path) + 1)) {
+		close(fd);
+		return;
+	}
+	ReplicaLink link = { fd };
+	pthread_mutex_lock(&hub->lock);
+	link.id = ++hub->next_id;
+	link.ack_us = GetMicroseconds();
+	hub->links[hub->nlinks++] = link;
+	pthread_mutex_unlock(&hub->lock);
+}
+
+//! ־ļ֮־˺תʵʱ
+//! ȶǰ־ٶϴǰ־䷢ļֻʹصȱ־ѱʱϿ
+static bool HubCatchUp(ReplicaHub *hub, ReplicaLink *link, uint64_t from_lsn) {
+	char path[512];
+	snprintf(path, sizeof(path), "%s.wal", hub->db_path);
+	size_t size = 0, old_size = 0;
+	uint8_t *current = LoadJournalFile(path, &size);
+	snprintf(path, sizeof(path), "%s.wal.old", hub->db_path);
+	uint8_t *old = LoadJournalFile(path, &old_size);
+	ByteBuffer data = { };
+	BBWrite(&data, old, old_size);
+	BBWrite(&data, current, size);
+	free(old);
+	free(current);
+	size_t offset = 0, begin = 0;
+	uint64_t lsn = from_lsn, first_lsn = 0, last_lsn = from_lsn;
+	Mutation m;
+	while (NextJournalEntry(data.data, data.size, &offset, &lsn, &m)) {
+		if (lsn <= from_lsn) begin = offset;
+		if (lsn > from_lsn && first_lsn == 0) first_lsn = lsn;
+		last_lsn = lsn > last_lsn ? lsn : last_lsn;
+	}
+	bool succeed = (first_lsn == 0 || first_lsn == from_lsn + 1)
+		&& (offset == begin
+		|| SendFrame(link->fd, ReplEntries, last_lsn, GetMicroseconds(), data.data + begin, offset - begin));
+	BBFree(&data);
+	pthread_mutex_lock(&hub->lock);
+	link->streaming = succeed;
+	link->acked_lsn = from_lsn;
+	pthread_mutex_unlock(&hub->lock);
+	return succeed;
+}
+
+static bool HubReceive(ReplicaHub *hub, ReplicaLink *link) {
+	ReplFrame frame;
+	if (!RecvAll(link->fd, &frame, sizeof(ReplFrame)) || frame.size != 0) return false;
+	if (frame.type == ReplSubscribe && !link->streaming) {
+		return HubCatchUp(hub, link, frame.lsn);
+	}
+	if (frame.type == ReplAck) {
+		pthread_mutex_lock(&hub->lock);
+		link->acked_lsn = frame.lsn;
+		link->lag_us = frame.stamp_us;
+		link->ack_us = GetMicroseconds();
+		pthread_mutex_unlock(&hub->lock);
+		return true;
+	}
+	return false;
+}
+
+//! ̣߳븱Ӧתβʱ
+static void* HubMain(void *args) {
+	ReplicaHub *hub = (ReplicaHub*)args;
+	int64_t heartbeat_us = GetMicroseconds();
+	while (true) {
+		struct pollfd fds[REPL_MAX_LINKS + 2] = { };
+		uint32_t nlinks = hub->nlinks;
+		fds[0].fd = hub->wake[0];
+		fds[1].fd = hub->listen_fd;
+		for (uint32_t i = 0; i < nlinks; ++i) {
+			fds[i + 2].fd = hub->links[i].fd;
 		}
-		for (int n = 0, size = db->header.book_rec_size; n < db->header.book_rec_num; ++n) {
-			BookRecord record;
-			fread(&record, size, 1, fp);
-			TLAppend(db->BookRecords, &record);
+		for (uint32_t i = 0; i < nlinks + 2; ++i) {
+			fds[i].events = POLLIN;
 		}
-		for (int n = 0, size = db->header.borrow_rec_size; n < db->header.borrow_rec_num; ++n) {
-			BorrowRecord record;
-			fread(&record, size, 1, fp);
-			TLAppend(db->BorrowRecords, &record);
+		poll(fds, nlinks + 2, REPL_HEARTBEAT_MS);
+		if (fds[0].revents & POLLIN) {
+			char drain[64];
+			read(hub->wake[0], drain, sizeof(drain));
 		}
-		db->header.account_rec_size = sizeof(AccountRecord);
-		db->header.book_rec_size = sizeof(BookRecord);
-		db->header.borrow_rec_size = sizeof(BorrowRecord);
+		pthread_mutex_lock(&hub->lock);
+		ByteBuffer batch = hub->pending;
+		uint64_t lsn = hub->published_lsn;
+		bool shutdown = hub->shutdown;
+		memset(&hub->pending, 0, sizeof(ByteBuffer));
+		pthread_mutex_unlock(&hub->lock);
+		//! ȡٴģͿص©
+		for (uint32_t i = nlinks; !shutdown && i-- > 0;) {
+			if (fds[i + 2].revents != 0 && !HubReceive(hub, &hub->links[i])) HubDrop(hub, i);
+		}
+		if (!shutdown && (fds[1].revents & POLLIN)) HubAccept(hub);
+		int64_t now = GetMicroseconds();
+		bool beat = now - heartbeat_us >= REPL_HEARTBEAT_MS * 1000;
+		for (uint32_t i = hub->nlinks; i-- > 0;) {
+			ReplicaLink *link = &hub->links[i];
+			if (!link->streaming) continue;
+			bool sent = true;
+			if (batch.size > 0) {
+				sent = SendFrame(link->fd, ReplEntries, lsn, now, batch.data, batch.size);
+			} else if (beat) {
+				sent = SendFrame(link->fd, ReplHeartbeat, lsn, now, NULL, 0);
+			}
+			if (!sent) HubDrop(hub, i);
+		}
+		if (beat) heartbeat_us = now;
+		BBFree(&batch);
+		if (shutdown) break;
 	}
-	return true;
+	return NULL;
 }
 
-bool ExportLibraryDB(LibraryDB *db, const char *path) {
-	if (!db) return false;
-	FILE *fp = fopen(path, "wb+");
+//! addressϽܸӣlsnΪǰӦõ־
+ReplicaHub* OpenReplicaHub(const char *address, const char *db_path, uint64_t lsn) {
+	int fd = ReplicaSocket(address, true);
+	if (fd < 0) return NULL;
+	ReplicaHub *hub = (ReplicaHub*)calloc(1, sizeof(ReplicaHub));
+	if (pipe(hub->wake) != 0) {
+		close(fd);
+		free(hub);
+		return NULL;
+	}
+	hub->listen_fd = fd;
+	hub->db_path = strdup(db_path);
+	hub->address = strdup(address);
+	hub->published_lsn = lsn;
+	pthread_mutex_init(&hub->lock, NULL);
+	pthread_create(&hub->thread, NULL, HubMain, hub);
+	return hub;
+}
+
+//! ʣκϿȫ
+void CloseReplicaHub(ReplicaHub *hub) {
+	if (!hub) return;
+	pthread_mutex_lock(&hub->lock);
+	hub->shutdown = true;
+	pthread_mutex_unlock(&hub->lock);
+	char signal = 1;
+	write(hub->wake[1], &signal, 1);
+	pthread_join(hub->thread, NULL);
+	for (uint32_t i = 0; i < hub->nlinks; ++i) {
+		close(hub->links[i].fd);
+	}
+	close(hub->listen_fd);
+	close(hub->wake[0]);
+	close(hub->wake[1]);
+	if (strspn(hub->address, "0123456789") != strlen(hub->address)) unlink(hub->address);
+	BBFree(&hub->pending);
+	pthread_mutex_destroy(&hub->lock);
+	free(hub->db_path);
+	free(hub->address);
+	free(hub);
+}
+
+//! Ⲣȡݿ·ʧܷ-1
+int ConnectPrimary(const char *address, char *db_path, size_t size) {
+	int fd = ReplicaSocket(address, false);
+	if (fd < 0) return -1;
+	ReplFrame frame;
+	bool succeed = RecvAll(fd, &frame, sizeof(ReplFrame)) && frame.type == ReplHello
+		&& frame.size > 0 && frame.size <= size && RecvAll(fd, db_path, frame.size);
+	if (!succeed) {
+		close(fd);
+		return -1;
+	}
+	db_path[frame.size - 1] = '\0';
+	return fd;
+}
+
+//! ̣߳Ӧ־ʱпرӦӳ
+static void* ReplicaMain(void *args) {
+	ReplicaClient *replica = (ReplicaClient*)args;
+	LibraryDB *db = replica->db;
+	ReplFrame frame;
+	uint8_t *payload = NULL;
+	size_t capacity = 0;
+	while (RecvAll(replica->fd, &frame, sizeof(ReplFrame))) {
+		if (frame.size > capacity) {
+			capacity = frame.size;
+			payload = (uint8_t*)realloc(payload, capacity);
+		}
+		if (frame.size > 0 && !RecvAll(replica->fd, payload, frame.size)) break;
+		if (frame.type != ReplEntries && frame.type != ReplHeartbeat) break;
+		int applied = 0;
+		pthread_mutex_lock(&db->lock);
+		if (frame.type == ReplEntries) ApplyJournalEntries(db, payload, frame.size, &applied);
+		uint64_t lsn = db->journal_lsn;
+		pthread_mutex_unlock(&db->lock);
+		int64_t now = GetMicroseconds();
+		pthread_mutex_lock(&replica->lock);
+		if (frame.lsn > replica->primary_lsn) replica->primary_lsn = frame.lsn;
+		if (frame.type == ReplEntries) replica->lag_us = now - frame.stamp_us;
+		replica->contact_us = now;
+		++replica->frames;
+		int64_t lag_us = replica->lag_us;
+		pthread_mutex_unlock(&replica->lock);
+		if (!SendFrame(replica->fd, ReplAck, lsn, lag_us, NULL, 0)) break;
+	}
+	free(payload);
+	pthread_mutex_lock(&replica->lock);
+	replica->connected = false;
+	pthread_mutex_unlock(&replica->lock);
+	return NULL;
+}
+
+//! ݿ⵱ǰŶ־
+ReplicaClient* StartReplicaClient(int fd, LibraryDB *db) {
+	if (!SendFrame(fd, ReplSubscribe, db->journal_lsn, GetMicroseconds(), NULL, 0)) return NULL;
+	ReplicaClient *replica = (ReplicaClient*)calloc(1, sizeof(ReplicaClient));
+	replica->fd = fd;
+	replica->db = db;
+	replica->primary_lsn = db->journal_lsn;
+	replica->contact_us = GetMicroseconds();
+	replica->connected = true;
+	pthread_mutex_init(&replica->lock, NULL);
+	pthread_create(&replica->thread, NULL, ReplicaMain, replica);
+	return replica;
+}
+
+void CloseReplicaClient(ReplicaClient *replica) {
+	if (!replica) return;
+	shutdown(replica->fd, SHUT_RDWR);
+	pthread_join(replica->thread, NULL);
+	close(replica->fd);
+	pthread_mutex_destroy(&replica->lock);
+	free(replica);
+}
+#else
+static void HubPublish(ReplicaHub *hub, const uint8_t *data, size_t size, uint64_t lsn) {
+}
+
+ReplicaHub* OpenReplicaHub(const char *address, const char *db_path, uint64_t lsn) {
+	puts("ǰƽ̨֧־ƣ");
+	return NULL;
+}
+
+void CloseReplicaHub(ReplicaHub *hub) {
+}
+
+int ConnectPrimary(const char *address, char *db_path, size_t size) {
+	puts("ǰƽ̨֧־ƣ");
+	return -1;
+}
+
+ReplicaClient* StartReplicaClient(int fd, LibraryDB *db) {
+	return NULL;
+}
+
+void CloseReplicaClient(ReplicaClient *replica) {
+}
+#endif
+
+/// ʱָ
+//! ÿinterval̨дԭؼΪ<path>.snap.<>־ǰ־תΪ<path>.seg.<>
+//! ָTȡʱ̲Tգطʱ䲻T־طԿռΪ
+//! Ŀ¼<path>.pitrHistoryFileInfoӸ־Ϣ
+#define HISTORY_MAGIC 0x52544950
+#define HISTORY_INTERVAL 1000
+#define HISTORY_KEEP 8
+
+static void SnapshotPath(char *buf, size_t size, const char *path, uint64_t lsn) {
+	snprintf(buf, size, "%s.snap.%llu", path, (unsigned long long)lsn);
+}
+
+static void SegmentPath(char *buf, size_t size, const char *path, uint64_t first_lsn) {
+	snprintf(buf, size, "%s.seg.%llu", path, (unsigned long long)first_lsn);
+}
+
+static bool SaveHistory(History *history) {
+	char path[512], tmp[512];
+	snprintf(path, sizeof(path), "%s.pitr", history->path);
+	snprintf(tmp, sizeof(tmp), "%s.pitr.tmp", history->path);
+	FILE *fp = fopen(tmp, "wb");
 	if (fp == NULL) return false;
-	fwrite(&db->header, sizeof(LibraryDBInfo), 1, fp);
-	for (TListNode *p = db->AccountRecords->head; p != NULL; p = p->next) {
-		fwrite(p->data, db->AccountRecords->node_size, 1, fp);
+	HistoryFileInfo info = { HISTORY_MAGIC, history->nsnapshots, history->nsegments };
+	bool succeed = fwrite(&info, sizeof(HistoryFileInfo), 1, fp) == 1
+		&& fwrite(history->snapshots, sizeof(SnapshotInfo), history->nsnapshots, fp) == history->nsnapshots
+		&& fwrite(history->segments, sizeof(SegmentInfo), history->nsegments, fp) == history->nsegments;
+	succeed = fclose(fp) == 0 && succeed;
+#ifdef _WIN32
+	if (succeed) remove(path);
+#endif
+	if (!succeed || rename(tmp, path) != 0) {
+		remove(tmp);
+		return false;
 	}
-	for (TListNode *p = db->BookRecords->head; p != NULL; p = p->next) {
-		fwrite(p->data, db->BookRecords->node_size, 1, fp);
+	return true;
+}
+
+static void AddSnapshot(History *history, uint64_t lsn) {
+	Timestamp now;
+	GetTimestamp(&now);
+	history->snapshots = (SnapshotInfo*)realloc(history->snapshots, (history->nsnapshots + 1) * sizeof(SnapshotInfo));
+	SnapshotInfo info = { lsn, PackTimestamp(&now) };
+	history->snapshots[history->nsnapshots++] = info;
+}
+
+//! ͬǰõ־һɾ
+static void PruneHistory(History *history) {
+	char buf[512];
+	uint32_t drop = history->nsnapshots > history->keep ? history->nsnapshots - history->keep : 0;
+	for (uint32_t i = 0; i < drop; ++i) {
+		SnapshotPath(buf, sizeof(buf), history->path, history->snapshots[i].lsn);
+		RemoveLibraryDB(buf);
 	}
-	for (TListNode *p = db->BorrowRecords->head; p != NULL; p = p->next) {
-		fwrite(p->data, db->BorrowRecords->node_size, 1, fp);
+	history->nsnapshots -= drop;
+	memmove(history->snapshots, history->snapshots + drop, history->nsnapshots * sizeof(SnapshotInfo));
+	uint64_t oldest = history->nsnapshots > 0 ? history->snapshots[0].lsn : 0;
+	uint32_t kept = 0;
+	for (uint32_t i = 0; i < history->nsegments; ++i) {
+		if (history->segments[i].last_lsn <= oldest) {
+			SegmentPath(buf, sizeof(buf), history->path, history->segments[i].first_lsn);
+			remove(buf);
+		} else {
+			history->segments[kept++] = history->segments[i];
+		}
+	}
+	history->nsegments = kept;
+}
+
+//! Ŀ¼״ʱԵǰΪգlsnΪ־
+History* OpenHistory(const char *path, uint64_t lsn) {
+	History *history = (History*)calloc(1, sizeof(History));
+	history->path = strdup(path);
+	const char *interval = getenv("LIBSYS_SNAPSHOT_INTERVAL");
+	history->interval = interval != NULL && atol(interval) > 0 ? atol(interval) : HISTORY_INTERVAL;
+	history->keep = HISTORY_KEEP;
+	char buf[512];
+	snprintf(buf, sizeof(buf), "%s.pitr", path);
+	FILE *fp = fopen(buf, "rb");
+	HistoryFileInfo info = { };
+	if (fp != NULL) {
+		if (fread(&info, sizeof(HistoryFileInfo), 1, fp) == 1 && info.magic == HISTORY_MAGIC) {
+			history->snapshots = (SnapshotInfo*)calloc(info.nsnapshots + 1, sizeof(SnapshotInfo));
+			history->segments = (SegmentInfo*)calloc(info.nsegments + 1, sizeof(SegmentInfo));
+			if (fread(history->snapshots, sizeof(SnapshotInfo), info.nsnapshots, fp) == info.nsnapshots
+				&& fread(history->segments, sizeof(SegmentInfo), info.nsegments, fp) == info.nsegments) {
+				history->nsnapshots = info.nsnapshots;
+				history->nsegments = info.nsegments;
+			}
+		}
+		fclose(fp);
+	}
+	if (history->nsnapshots == 0) {
+		SnapshotPath(buf, sizeof(buf), path, lsn);
+		if (LinkLibraryDB(path, buf)) {
+			AddSnapshot(history, lsn);
+			SaveHistory(history);
+		} else {
+			puts("մʧܣݲ֧ʱָ");
+		}
+	}
+	return history;
+}
+
+void CloseHistory(History *history) {
+	if (!history) return;
+	free(history->snapshots);
+	free(history->segments);
+	free(history->path);
+	free(history);
+}
+
+static uint64_t NextSnapshotLSN(History *history) {
+	uint64_t last = history->nsnapshots > 0 ? history->snapshots[history->nsnapshots - 1].lsn : 0;
+	return last + history->interval;
+}
+
+//! һintervalʱдԭؼΪգ߳п
+static void SnapshotIfDue(LibraryDB *db) {
+	History *history = db->History;
+	if (db->journal_lsn < NextSnapshotLSN(history)) return;
+	char buf[512];
+	SnapshotPath(buf, sizeof(buf), history->path, db->journal_lsn);
+	if (!LinkLibraryDB(history->path, buf)) {
+		RemoveLibraryDB(buf);
+		return;
+	}
+	AddSnapshot(history, db->journal_lsn);
+	PruneHistory(history);
+	SaveHistory(history);
+}
+
+//! ǰ־תΪ־Σ޿תʱͬtrue
+bool RetainJournal(History *history) {
+	char wal[512], buf[512];
+	snprintf(wal, sizeof(wal), "%s.wal", history->path);
+	size_t size = 0, offset = 0;
+	uint8_t *data = LoadJournalFile(wal, &size);
+	SegmentInfo segment = { };
+	uint64_t lsn;
+	Mutation m;
+	while (NextJournalEntry(data, size, &offset, &lsn, &m)) {
+		if (segment.first_lsn == 0) segment.first_lsn = lsn;
+		segment.last_lsn = lsn;
+	}
+	free(data);
+	if (segment.first_lsn == 0) return true;
+	SegmentPath(buf, sizeof(buf), history->path, segment.first_lsn);
+	if (!DuplicateFile(wal, buf)) return false;
+	TruncateFile(buf, offset);
+	history->segments = (SegmentInfo*)realloc(history->segments, (history->nsegments + 1) * sizeof(SegmentInfo));
+	history->segments[history->nsegments++] = segment;
+	return SaveHistory(history);
+}
+
+//! ط־뵱ǰ־dbʱ䲻tmطĿ
+static int ReplayHistory(LibraryDB *db, History *history, uint64_t tm) {
+	int replayed = 0;
+	for (uint32_t i = 0; i <= history->nsegments; ++i) {
+		char buf[512];
+		if (i < history->nsegments) {
+			if (history->segments[i].last_lsn <= db->journal_lsn) continue;
+			SegmentPath(buf, sizeof(buf), history->path, history->segments[i].first_lsn);
+		} else {
+			snprintf(buf, sizeof(buf), "%s.wal", history->path);
+		}
+		size_t size = 0, offset = 0;
+		uint8_t *data = LoadJournalFile(buf, &size);
+		uint64_t lsn;
+		Mutation m;
+		bool reached = false;
+		while (!reached && NextJournalEntry(data, size, &offset, &lsn, &m)) {
+			if (lsn <= db->journal_lsn) continue;
+			reached = PackTimestamp(&m.tm) > tm;
+			if (reached) break;
+			DbApply(db, &m);
+			db->journal_lsn = lsn;
+			++replayed;
+		}
+		free(data);
+		if (reached) break;
+	}
+	return replayed;
+}
+
+void CloseLibraryDBAsOf(LibraryDB *db, const char *scratch) {
+	if (db->AccountRecords != NULL) CloseLibraryDB(db);
+	IODestroy(db->IO);
+	pthread_mutex_destroy(&db->lock);
+	RemoveLibraryDB(scratch);
+}
+
+//! scratchؽtmʱ̵ݣ߳ԴձգطĿʧʱ-1
+int OpenLibraryDBAsOf(LibraryDB *db, History *history, uint64_t tm, const char *scratch, ThreadPool *workers) {
+	const SnapshotInfo *base = NULL;
+	for (uint32_t i = 0; i < history->nsnapshots; ++i) {
+		if (history->snapshots[i].tm <= tm) base = &history->snapshots[i];
+	}
+	memset(db, 0, sizeof(LibraryDB));
+	pthread_mutex_init(&db->lock, NULL);
+	db->IO = MakeIOBackend();
+	char buf[512];
+	if (base != NULL) SnapshotPath(buf, sizeof(buf), history->path, base->lsn);
+	if (base == NULL || !CopyLibraryDB(buf, scratch) || !OpenLibraryDB(db, scratch, workers)) {
+		CloseLibraryDBAsOf(db, scratch);
+		return -1;
+	}
+	return ReplayHistory(db, history, tm);
+}
+
+//! lsnĿ־ָ±lsn֮д
+static void TrimHistory(History *history, uint64_t lsn) {
+	char buf[512];
+	uint32_t kept = 0;
+	for (uint32_t i = 0; i < history->nsnapshots; ++i) {
+		if (history->snapshots[i].lsn > lsn) {
+			SnapshotPath(buf, sizeof(buf), history->path, history->snapshots[i].lsn);
+			RemoveLibraryDB(buf);
+		} else {
+			history->snapshots[kept++] = history->snapshots[i];
+		}
+	}
+	history->nsnapshots = kept;
+	kept = 0;
+	for (uint32_t i = 0; i < history->nsegments; ++i) {
+		SegmentInfo *segment = &history->segments[i];
+		SegmentPath(buf, sizeof(buf), history->path, segment->first_lsn);
+		if (segment->first_lsn > lsn) {
+			remove(buf);
+			continue;
+		}
+		if (segment->last_lsn > lsn) {
+			size_t size = 0, offset = 0, end = 0;
+			uint8_t *data = LoadJournalFile(buf, &size);
+			uint64_t entry_lsn;
+			Mutation m;
+			while (NextJournalEntry(data, size, &offset, &entry_lsn, &m) && entry_lsn <= lsn) {
+				end = offset;
+				segment->last_lsn = entry_lsn;
+			}
+			free(data);
+			TruncateFile(buf, end);
+		}
+		history->segments[kept++] = *segment;
+	}
+	history->nsegments = kept;
+	SaveHistory(history);
+}
+
+/// ̨
+//! ÿintervalԭдƬ鵵Σ־ʹ־طн
+#define CHECKPOINT_INTERVAL 1000
+
+//! дԭؼ㣬յʱһӣ־ȫתգ߳п
+static bool Checkpoint(LibraryDB *db, const char *path) {
+	bool durable = db->Log != NULL && JournalWait(db->Log, db->journal_lsn);
+	if (!ExportLibraryDB(db, path)) return false;
+	if (db->History != NULL) SnapshotIfDue(db);
+	if (!durable || (db->History != NULL && !RetainJournal(db->History))) return false;
+	return JournalReset(db->Log, path);
+}
+
+static uint64_t NextCheckpointLSN(Checkpointer *cp) {
+	LibraryDB *db = cp->db;
+	uint64_t due = db->journal_lsn + cp->interval;
+	if (db->History != NULL && NextSnapshotLSN(db->History) < due) due = NextSnapshotLSN(db->History);
+	return due;
+}
+
+//! ̣߳Ѻȡд㣬ύ·ֻ
+static void* CheckpointWorker(void *args) {
+	Checkpointer *cp = (Checkpointer*)args;
+	LibraryDB *db = cp->db;
+	pthread_mutex_lock(&cp->lock);
+	while (true) {
+		while (!cp->shutdown && !cp->requested) {
+			pthread_cond_wait(&cp->wake, &cp->lock);
+		}
+		if (cp->shutdown) break;
+		cp->requested = false;
+		pthread_mutex_unlock(&cp->lock);
+		pthread_mutex_lock(&db->lock);
+		Checkpoint(db, cp->path);
+		uint64_t due = NextCheckpointLSN(cp);
+		pthread_mutex_unlock(&db->lock);
+		pthread_mutex_lock(&cp->lock);
+		cp->due_lsn = due;
+	}
+	pthread_mutex_unlock(&cp->lock);
+	return NULL;
+}
+
+//! ɻLIBSYS_CHECKPOINT_INTERVALڿʷ֮
+Checkpointer* StartCheckpointer(LibraryDB *db, const char *path) {
+	Checkpointer *cp = (Checkpointer*)calloc(1, sizeof(Checkpointer));
+	cp->db = db;
+	cp->path = strdup(path);
+	const char *interval = getenv("LIBSYS_CHECKPOINT_INTERVAL");
+	cp->interval = interval != NULL && atol(interval) > 0 ? atol(interval) : CHECKPOINT_INTERVAL;
+	cp->due_lsn = NextCheckpointLSN(cp);
+	pthread_mutex_init(&cp->lock, NULL);
+	pthread_cond_init(&cp->wake, NULL);
+	pthread_create(&cp->thread, NULL, CheckpointWorker, cp);
+	return cp;
+}
+
+//! δʼļ㣬ȴеļ
+void StopCheckpointer(Checkpointer *cp) {
+	if (!cp) return;
+	pthread_mutex_lock(&cp->lock);
+	cp->shutdown = true;
+	pthread_cond_signal(&cp->wake);
+	pthread_mutex_unlock(&cp->lock);
+	pthread_join(cp->thread, NULL);
+	pthread_mutex_destroy(&cp->lock);
+	pthread_cond_destroy(&cp->wake);
+	free(cp->path);
+	free(cp);
+}
+
+//! ӦúãյʱѼ߳
+static void CheckpointIfDue(Checkpointer *cp, uint64_t lsn) {
+	pthread_mutex_lock(&cp->lock);
+	if (lsn >= cp->due_lsn && !cp->requested) {
+		cp->requested = true;
+		pthread_cond_signal(&cp->wake);
+	}
+	pthread_mutex_unlock(&cp->lock);
+}
+
+/// ظ
+//! ҵ˳дļʼ¼ʱĿΪ<trace>.dbط
+#define TRACE_MAGIC 0x4352544c
+#define TRACE_VERSION 1
+
+typedef struct tracefileinfo_s {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t unused;
+} TraceFileInfo;
+
+TraceRecorder* OpenTraceRecorder(const char *path, LibraryDB *db) {
+	char buf[512];
+	snprintf(buf, sizeof(buf), "%s.db", path);
+	if (!ExportLibraryDB(db, buf)) return NULL;
+	FILE *fp = fopen(path, "wb");
+	if (fp == NULL) return NULL;
+	TraceFileInfo info = { TRACE_MAGIC, TRACE_VERSION };
+	fwrite(&info, sizeof(TraceFileInfo), 1, fp);
+	TraceRecorder *trace = (TraceRecorder*)calloc(1, sizeof(TraceRecorder));
+	trace->fp = fp;
+	trace->begin_us = trace->last_us = GetMicroseconds();
+	pthread_mutex_init(&trace->lock, NULL);
+	return trace;
+}
+
+void CloseTraceRecorder(TraceRecorder *trace) {
+	if (!trace) return;
+	fclose(trace->fp);
+	pthread_mutex_destroy(&trace->lock);
+	free(trace);
+}
+
+//! ʱǰһ¼ֱ
+void TraceRecord(TraceRecorder *trace, const TraceEvent *event) {
+	ByteBuffer buffer = { };
+	pthread_mutex_lock(&trace->lock);
+	BBPutVarint(&buffer, event->op);
+	BBPutVarint(&buffer, event->token);
+	BBPutVarint(&buffer, ZigZag(event->start_us - trace->last_us));
+	BBPutVarint(&buffer, event->latency_us);
+	BBPutVarint(&buffer, event->id);
+	BBPutVarint(&buffer, event->isbn);
+	BBPutVarint(&buffer, ZigZag(event->value));
+	for (int i = 0; i < 3; ++i) {
+		size_t len = strnlen(event->text[i], sizeof(event->text[i]) - 1);
+		BBPutVarint(&buffer, len);
+		BBWrite(&buffer, event->text[i], len);
+	}
+	fwrite(buffer.data, 1, buffer.size, trace->fp);
+	trace->last_us = event->start_us;
+	++trace->events;
+	pthread_mutex_unlock(&trace->lock);
+	BBFree(&buffer);
+}
+
+//! ļʱ任ΪԸٿʼ
+TraceEvent* LoadTrace(const char *path, size_t *num) {
+	FILE *fp = fopen(path, "rb");
+	if (fp == NULL) return NULL;
+	TraceFileInfo info = { };
+	if (fread(&info, sizeof(TraceFileInfo), 1, fp) != 1 || info.magic != TRACE_MAGIC) {
+		fclose(fp);
+		return NULL;
 	}
+	long begin = ftell(fp);
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp) - begin;
+	fseek(fp, begin, SEEK_SET);
+	uint8_t *data = (uint8_t*)malloc(size + 1);
+	if (fread(data, 1, size, fp) != (size_t)size) size = 0;
 	fclose(fp);
-	return true;
+	size_t count = 0, capacity = 64;
+	TraceEvent *events = (TraceEvent*)malloc(capacity * sizeof(TraceEvent));
+	const uint8_t *p = data, *end = data + size;
+	int64_t start = 0;
+	while (p < end) {
+		uint64_t op, token, delta, latency, id, isbn, value;
+		TraceEvent event = { };
+		if (!GetVarint(&p, end, &op) || !GetVarint(&p, end, &token) || !GetVarint(&p, end, &delta)) break;
+		if (!GetVarint(&p, end, &latency) || !GetVarint(&p, end, &id)) break;
+		if (!GetVarint(&p, end, &isbn) || !GetVarint(&p, end, &value)) break;
+		bool complete = true;
+		for (int i = 0; complete && i < 3; ++i) {
+			uint64_t len;
+			complete = GetVarint(&p, end, &len) && len < sizeof(event.text[i]) && len <= (uint64_t)(end - p);
+			if (complete) {
+				memcpy(event.text[i], p, len);
+				p += len;
+			}
+		}
+		if (!complete) break;
+		start += UnZigZag(delta);
+		event.op = op;
+		event.token = token;
+		event.start_us = start;
+		event.latency_us = latency;
+		event.id = id;
+		event.isbn = isbn;
+		event.value = UnZigZag(value);
+		if (count == capacity) {
+			capacity *= 2;
+			events = (TraceEvent*)realloc(events, capacity * sizeof(TraceEvent));
+		}
+		events[count++] = event;
+	}
+	free(data);
+	*num = count;
+	return events;
 }
 
-void CloseLibraryDB(LibraryDB *db) {
-	TLDestroy(db->AccountRecords);
-	TLDestroy(db->BookRecords);
-	TLDestroy(db->BorrowRecords);
-	db->AccountRecords = NULL;
-	db->BookRecords = NULL;
-	db->BorrowRecords = NULL;
+const char* TraceOpName(int op) {
+	switch (op) {
+		case TraceLogin: return "¼";
+		case TraceSearch: return "";
+		case OpRegister: return "ע";
+		case OpCancel: return "ע";
+		case OpResetPassword: return "";
+		case OpRecharge: return "ֵ";
+		case OpAddBook: return "Ŀ";
+		case OpBorrow: return "";
+		case OpReturn: return "黹";
+		case OpReserve: return "ԤԼ";
+	}
+	return "δ֪";
 }
 
-/// Ựҵ
-bool AccountHashMatch(AccountRecord *record, AccountRecord *info) {
-	if (record->hashkey != info->hashkey) return false;
-	if (strcmp(record->account, info->account) != 0) return false;
-	return true;
+typedef struct replayname_s {
+	uint32_t id;
+	char account[64];
+} ReplayName;
+
+//! طע˻ֵܷòͬID˻ΪطſеID
+static uint32_t ReplayAccountID(ReplayWorker *worker, uint32_t id) {
+	if (id == 0) return 0;
+	char account[64] = { };
+	size_t cursor = 0;
+	pthread_mutex_lock(&worker->accounts->lock);
+	ReplayName *name = (ReplayName*)HINext(worker->accounts->names, id, &cursor);
+	if (name != NULL) strcpy(account, name->account);
+	pthread_mutex_unlock(&worker->accounts->lock);
+	if (name == NULL) return id;
+	LibraryDB *db = &worker->sys->database;
+	pthread_mutex_lock(&db->lock);
+	AccountRecord *user = FindAccount(db, account);
+	uint32_t replayed = user != NULL ? user->id : 0;
+	pthread_mutex_unlock(&db->lock);
+	return replayed;
 }
 
-bool AccountIDMatch(AccountRecord *record, uint32_t *pid) {
-	return record->id == *pid;
+static void ReplayRegistered(ReplayWorker *worker, uint32_t id, const char *account) {
+	ReplayName *name = (ReplayName*)calloc(1, sizeof(ReplayName));
+	name->id = id;
+	strcpy(name->account, account);
+	size_t cursor = 0;
+	pthread_mutex_lock(&worker->accounts->lock);
+	ReplayName *prev = (ReplayName*)HINext(worker->accounts->names, id, &cursor);
+	if (prev != NULL) {
+		HIErase(worker->accounts->names, id, prev);
+		free(prev);
+	}
+	HIInsert(worker->accounts->names, id, name);
+	pthread_mutex_unlock(&worker->accounts->lock);
 }
 
-bool ISBNMatch(BookRecord *record, const char *ISBN) {
-	return strcmp(record->ISBN, ISBN) == 0;
+//! ÿ¼ĻỰӦһݶϵͳͼ¼ExclusiveLogin
+static void ReplayLogin(ReplayWorker *worker, const TraceEvent *event) {
+	LibrarySystem sys = worker->sys;
+	ReplaySession *session = NULL;
+	size_t cursor = 0;
+	while ((session = (ReplaySession*)HINext(worker->sessions, (uint32_t)event->token, &cursor)) != NULL) {
+		if (session->token == event->token) break;
+	}
+	if (session == NULL) {
+		session = (ReplaySession*)calloc(1, sizeof(ReplaySession));
+		session->token = event->token;
+		HIInsert(worker->sessions, (uint32_t)event->token, session);
+	}
+	pthread_mutex_lock(&sys->database.lock);
+	uint64_t token = session->sys.token;
+	session->sys = *sys;
+	session->sys.token = token;
+	session->sys.trace = NULL;
+	AccountRecord *user = FindAccount(&sys->database, event->text[0]);
+	char password[sizeof(user->password)] = { };
+	if (user != NULL) strcpy(password, user->password); // passwords are not traced
+	ExclusiveLogin(&session->sys, event->text[0], password);
+	pthread_mutex_unlock(&sys->database.lock);
 }
 
-bool ExclusiveLogin(LibrarySystem sys, const char *account, const char *password) {
-	AccountRecord info = { }, *user = NULL;
-	strcpy(info.account, account);
-	info.hashkey = hash(account);
-	user = (AccountRecord*)TLMatch(sys->database.AccountRecords, (void*)AccountHashMatch, &info, false);
-	if (!user) return false;
-	if (strcmp(user->password, password) != 0) return false;
-	sys->session = (SessionID)calloc(1, sizeof(Session));
-	sys->session->host_ref = user;
-	Timestamp tm;
-	GetTimestamp(&sys->session->tm_establish);
-	return true;
+static void ReplayLogout(ReplayWorker *worker) {
+	HashIndex *sessions = worker->sessions;
+	for (size_t i = 0; i < sessions->capacity; ++i) {
+		ReplaySession *session = (ReplaySession*)sessions->entries[i].ref;
+		if (session == NULL || session == HI_TOMBSTONE) continue;
+		if (session->sys.token != 0) {
+			SMClose(worker->sys->sessions, session->sys.token);
+		}
+		free(session);
+	}
+	HIDestroy(sessions);
+	worker->sessions = NULL;
 }
 
-void RegisterAccount(LibrarySystem sys, const char *account, const char *password) {
-	AccountRecord record;
-	strcpy(record.account, account);
-	strcpy(record.password, password);
-	record.hashkey = hash(account);
-	record.group = User;
-	record.id = (uint32_t)(rand() * rand());
-	record.amount = 0;
-	GetTimestamp(&record.tm_register);
-	TLAppend(sys->database.AccountRecords, &record);
-	++sys->database.header.account_rec_num;
+//! Եǰʱִһβͬɿ
+static void ReplayEvent(ReplayWorker *worker, const TraceEvent *event) {
+	LibraryDB *db = &worker->sys->database;
+	Mutation m = { event->op, 0, event->isbn, event->value };
+	memcpy(m.text, event->text, sizeof(m.text));
+	switch (event->op) {
+		case TraceLogin: {
+			ReplayLogin(worker, event);
+			return;
+		}
+		case TraceSearch: {
+			BookRecord *results[COMPLETE_MAX];
+			size_t num = 0;
+			bool owned = false;
+			pthread_mutex_lock(&db->lock);
+			if (event->value == SearchPrefix) {
+				CompleteBooks(db, event->text[0], results, COMPLETE_MAX);
+			} else {
+				BookRecord **found = SearchBooks(db, event->value, event->text[0], &num, &owned);
+				if (owned) free(found);
+			}
+			pthread_mutex_unlock(&db->lock);
+			return;
+		}
+		case OpRegister: {
+			strcpy(m.text[1], "replay"); // passwords are not traced
+		}
+		break;
+		case OpReturn: {
+			//! ʱطű仯Ŀȡһ
+			m.id = ReplayAccountID(worker, event->id);
+			TListNode *node = NULL;
+			size_t cursor = 0;
+			pthread_mutex_lock(&db->lock);
+			while ((node = HINext(db->LoanIndex, m.id, &cursor)) != NULL) {
+				BorrowRecord *record = (BorrowRecord*)node->data;
+				if (record->isbn != event->isbn) continue;
+				if (m.tm_ref.year == 0 || PackTimestamp(&record->tm_borrow) < PackTimestamp(&m.tm_ref)) {
+					m.tm_ref = record->tm_borrow;
+				}
+			}
+			pthread_mutex_unlock(&db->lock);
+		}
+		break;
+		default: {
+			m.id = ReplayAccountID(worker, event->id);
+		}
+		break;
+	}
+	GetTimestamp(&m.tm);
+	if (Mutate(db, &m) && event->op == OpRegister && event->id != 0) {
+		ReplayRegistered(worker, event->id, event->text[0]);
+	}
 }
 
-int GetBorrowNum(LibrarySystem sys) {
-	if (sys->session == NULL) return 0;
-	int id = sys->session->host_ref->id, count = 0;
-	TListNode *p = sys->database.BorrowRecords->head;
-	while (p != NULL) {
-		BorrowRecord *record = (BorrowRecord*)p->data;
-		if (record->borrower_id == id && record->tm_return.year == -1) {
-			++count;
+//! Ự̶ͬһ̰߳ԭ˳ط
+static void* ReplayWorkerMain(void *args) {
+	ReplayWorker *worker = (ReplayWorker*)args;
+	for (size_t i = 0; i < worker->nevents; ++i) {
+		const TraceEvent *event = &worker->events[i];
+		if ((event->token * 0x9e3779b97f4a7c15ull >> 32) % worker->nthreads != worker->index) continue;
+		if (worker->paced) {
+			int64_t wait = worker->begin_us + event->start_us - GetMicroseconds();
+			if (wait > 0) usleep(wait);
 		}
-		p = p->next;
+		int64_t start = GetMicroseconds();
+		ReplayEvent(worker, event);
+		worker->latency[i] = GetMicroseconds() - start;
 	}
-	return count;
+	ReplayLogout(worker);
+	return NULL;
+}
+
+static int CompareLatency(const void *lhs, const void *rhs) {
+	uint32_t a = *(const uint32_t*)lhs, b = *(const uint32_t*)rhs;
+	return a < b ? -1 : a > b;
+}
+
+//! ͶԱȼ¼طźʱ
+void PrintReplayReport(const TraceEvent *events, const uint32_t *latency, size_t nevents, int64_t wall_us) {
+	static const int ops[] = { TraceLogin, TraceSearch, OpRegister, OpCancel, OpResetPassword,
+		OpRecharge, OpAddBook, OpBorrow, OpReturn, OpReserve };
+	uint32_t *samples = (uint32_t*)malloc((nevents + 1) * sizeof(uint32_t));
+	puts("[^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^]");
+	puts("   ¼ֵ(us) طžֵ(us) 仯 طP50(us) طP99(us)");
+	for (size_t k = 0; k < sizeof(ops) / sizeof(ops[0]); ++k) {
+		size_t n = 0;
+		double recorded = 0, replayed = 0;
+		for (size_t i = 0; i < nevents; ++i) {
+			if (events[i].op != ops[k]) continue;
+			recorded += events[i].latency_us;
+			replayed += latency[i];
+			samples[n++] = latency[i];
+		}
+		if (n == 0) continue;
+		qsort(samples, n, sizeof(uint32_t), CompareLatency);
+		recorded /= n;
+		replayed /= n;
+		printf(" %s %u %.1f %.1f %+.1f%% %u %u\n", TraceOpName(ops[k]), (unsigned)n, recorded, replayed,
+			recorded > 0 ? (replayed - recorded) * 100 / recorded : 0.0,
+			samples[n / 2], samples[n - 1 - n / 100]);
+	}
+	printf(" %u ʱ%.3f %.1f/\n", (unsigned)nevents, wall_us * 1e-6,
+		wall_us > 0 ? nevents * 1e6 / wall_us : 0.0);
+	puts("[______________________________]");
+	free(samples);
 }
 
 /// ҵ
+//! ÿνǰڻỰʱص¼
+bool SvrKeepAlive(LibrarySystem sys) {
+	sys->session = sys->token != 0 && SMResolve(sys->sessions, sys->token, &sys->current) ? &sys->current : NULL;
+	if (sys->token != 0 && sys->session == NULL) {
+		puts("Ựѳʱµ¼");
+		sys->token = 0;
+	}
+	return sys->session != NULL;
+}
+
+//! ¼һҵδʱ
+void SvrTrace(LibrarySystem sys, TraceEvent *event, int64_t start) {
+	if (sys->trace == NULL) return;
+	event->token = sys->token;
+	event->start_us = start;
+	event->latency_us = GetMicroseconds() - start;
+	TraceRecord(sys->trace, event);
+}
+
+//! ύ־δʱʾ
+bool SvrCommit(LibrarySystem sys, Mutation *m) {
+	if (sys->readonly) {
+		puts("ֻʵ");
+		return false;
+	}
+	GetTimestamp(&m->tm);
+	int64_t start = GetMicroseconds();
+	bool applied = Mutate(&sys->database, m);
+	if (applied && sys->database.Checkpoint != NULL) {
+		CheckpointIfDue(sys->database.Checkpoint, __atomic_load_n(&sys->database.journal_lsn, __ATOMIC_RELAXED));
+	}
+	TraceEvent event = { m->op, 0, 0, 0, m->id, m->isbn, m->value };
+	memcpy(event.text, m->text, sizeof(event.text));
+	if (m->op == OpRegister) {
+		memset(event.text[1], 0, sizeof(event.text[1]));
+		event.id = applied ? m->result : 0;
+	}
+	SvrTrace(sys, &event, start);
+	if (applied && !m->durable) {
+		puts("־дʧܣδ־û");
+	}
+	return applied;
+}
+
 //! ʼϢ
 void SvrInitial(LibrarySystem sys) {
 	puts(
@@ -455,6 +6578,19 @@ void SvrInitial(LibrarySystem sys) {
 }
 
 //! ¼
+//! ¼ʱͶݵ֪ͨ
+void SvrNotices(LibrarySystem sys) {
+	TListNode *node = NULL;
+	size_t cursor = 0;
+	while ((node = HINext(sys->database.Inbox, sys->session->host_ref->id, &cursor)) != NULL) {
+		HoldRecord *record = (HoldRecord*)node->data;
+		BookRecord *book = FindBookByKey(&sys->database, record->isbn);
+		if (book == NULL) continue;
+		printf("ԤԼġ%s%4d-%02d-%02dݣ%d죬뾡ģ\n", BookName(&sys->database, book),
+			record->tm_ready.year, record->tm_ready.month, record->tm_ready.day, HOLD_KEEP_DAYS);
+	}
+}
+
 void SvrLogin(LibrarySystem sys) {
 	char opt = getoption(
 "====ѡ====" "\n"
@@ -471,9 +6607,14 @@ void SvrLogin(LibrarySystem sys) {
 				char account[64], password[64];
 				getline("˻", account);
 				getline("룺", password);
+				int64_t start = GetMicroseconds();
 				bool succeed = ExclusiveLogin(sys, account, password);
 				if (succeed) {
+					TraceEvent event = { TraceLogin };
+					strcpy(event.text[0], account);
+					SvrTrace(sys, &event, start);
 					puts("½ɹ");
+					SvrNotices(sys);
 					break;
 				}
 				puts("˻");
@@ -492,18 +6633,24 @@ void SvrLogin(LibrarySystem sys) {
 				getline("˻", account);
 				getline("룺", password);
 				getline("ȷ룺", confirm);
-				AccountRecord record;
-				strcpy(record.account, account);
-				strcpy(record.password, password);
-				record.hashkey = hash(account);
 				if (strcmp(password, confirm) != 0) {
 					puts("벻һ£ԣ");
-				} else if (TLMatch(sys->database.AccountRecords, (void*)AccountHashMatch, &record, false)) {
+				} else if (FindAccount(&sys->database, account)) {
 					puts("˺Ѵڣԣ");
+				} else if (strlen(account) >= sizeof(sys->current.host_ref->account)
+					|| strlen(password) >= sizeof(sys->current.host_ref->password)) {
+					puts("˻ԣ");
 				} else {
-					RegisterAccount(sys, account, password);
-					puts("עɹ");
-					break;
+					Mutation m = { OpRegister };
+					strcpy(m.text[0], account);
+					strcpy(m.text[1], password);
+					if (SvrCommit(sys, &m)) {
+						puts("עɹ");
+						break;
+					}
+					//! ֻʵSvrCommitʾʧнͬ˻ǡעʱIDľ
+					if (sys->readonly) break;
+					puts(FindAccount(&sys->database, account) ? "˺Ѵڣԣ" : "˻IDѺľעʧܣ");
 				}
 				if (++nfailed == 3) {
 					bool retry = true;
@@ -538,7 +6685,7 @@ void SvrLogin(LibrarySystem sys) {
 void SvrDatacard(LibrarySystem sys) {
 	AccountRecord *user = sys->session->host_ref;
 	puts("================");
-	printf("ID%d\n", user->id);
+	printf("ID%u\n", user->id);
 	printf("˻%s\n", user->account);
 	printf("룺%s\n", user->password);
 	printf("%.2fԪ\n", user->amount * 0.01f);
@@ -552,40 +6699,289 @@ void SvrDatacard(LibrarySystem sys) {
 	puts("================");
 	getoption("[Y] ");
 }
-
-//! ˻ע
-void SvrCancelAccount(LibrarySystem sys) {
-	if (sys->session->host_ref->id == 1) {
+
+//! עָ˻رȫỰ
+void SvrCancelTarget(LibrarySystem sys, AccountRecord *target) {
+	if (target->id == 1) {
 		puts("޷ɾùԱ˻");
 		return;
 	}
-	if (GetBorrowNum(sys) > 0) {
+	if (GetLoanNum(&sys->database, target->id) > 0) {
 		puts("鼮δȫ黹עѾܾ");
-	} else if (sys->session->host_ref->amount < 0) {
+	} else if (target->amount < 0) {
 		puts("ǰ˻ͻδɣעѾܾ");
 	} else {
-		TListNode *node = TLFind(sys->database.AccountRecords, sys->session->host_ref, true);
-		bool succeed = TLErase(sys->database.AccountRecords, node);
-		if (succeed) {
-			--sys->database.header.account_rec_num;
-			free(sys->session);
-			sys->session = NULL;
-			puts("˻עɹ");
-		} else {
+		Mutation m = { OpCancel, target->id };
+		if (!SvrCommit(sys, &m)) {
 			puts("δ֪˻עʧܣ");
+			return;
+		}
+		//! ˻ĻỰرգ˴
+		if (sys->session != NULL && sys->session->host_ref == target) {
+			sys->session = NULL;
+			sys->token = 0;
 		}
+		puts("˻עɹ");
 	}
 }
 
+//! ˻ע
+void SvrCancelAccount(LibrarySystem sys) {
+	SvrCancelTarget(sys, sys->session->host_ref);
+}
+
 //! ֵ
 void SvrRecharge(LibrarySystem sys) {
 	char buffer[64];
 	getline("ֵ", buffer);
-	int amount = atoi(buffer);
-	if (amount > 0) {
-		sys->session->host_ref->amount += amount * 100;
+	if (sys->session == NULL) return;
+	Mutation m = { OpRecharge, sys->session->host_ref->id };
+	m.value = (int64_t)atoi(buffer) * 100;
+	puts(m.value > 0 && SvrCommit(sys, &m) ? "ֵɹ" : "Чֵ");
+}
+
+//! ͳƱ
+void SvrReport(LibrarySystem sys) {
+	Report *report = RunReport(&sys->database, sys->workers, ReportAll);
+	puts("[^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^]");
+	PrintReport(report, sys->database.Strings, stdout, false);
+	SearchCache *cache = sys->database.Searches;
+	uint64_t lookups = cache->hits + cache->misses;
+	printf(" 棺%.1f%% Ŀ%u/%u ռ%u/%uֽ ʧЧ%u\n",
+		lookups > 0 ? cache->hits * 100.0 / lookups : 0.0,
+		(unsigned)cache->entries, (unsigned)cache->max_entries,
+		(unsigned)cache->bytes, (unsigned)cache->max_bytes, (unsigned)cache->invalidations);
+	Journal *log = sys->database.Log;
+	if (log != NULL) {
+		pthread_mutex_lock(&log->lock);
+		printf(" ־%u %u д%s ϵͳ%u ϵͳ%u\n",
+			(unsigned)log->entries, (unsigned)log->batches,
+			IOBackendName(log->io), (unsigned)log->io->syscalls, (unsigned)sys->database.IO->syscalls);
+		pthread_mutex_unlock(&log->lock);
+	}
+	ReplicaHub *hub = sys->hub;
+	if (hub != NULL) {
+		pthread_mutex_lock(&hub->lock);
+		printf(" ־ƣ%u %u\n", (unsigned)hub->published_lsn, (unsigned)hub->nlinks);
+		int64_t now = GetMicroseconds();
+		for (uint32_t i = 0; i < hub->nlinks; ++i) {
+			ReplicaLink *link = &hub->links[i];
+			printf("  #%u %s Ӧ%u %u Ӧӳ%.1f %.1fǰӦ\n", link->id,
+				link->streaming ? "ͬ" : "", (unsigned)link->acked_lsn,
+				(unsigned)(hub->published_lsn - link->acked_lsn), link->lag_us / 1000.0,
+				(now - link->ack_us) / 1e6);
+		}
+		pthread_mutex_unlock(&hub->lock);
+	}
+	ReplicaClient *replica = sys->replica;
+	if (replica != NULL) {
+		pthread_mutex_lock(&replica->lock);
+		uint64_t applied = sys->database.journal_lsn;
+		printf(" ֻ%s Ӧ%u %u %u Ӧӳ%.1f %.1fǰ\n",
+			replica->connected ? "" : "ѶϿ", (unsigned)applied, (unsigned)replica->primary_lsn,
+			(unsigned)(replica->primary_lsn > applied ? replica->primary_lsn - applied : 0),
+			replica->lag_us / 1000.0, (GetMicroseconds() - replica->contact_us) / 1e6);
+		pthread_mutex_unlock(&replica->lock);
+	}
+	puts("[______________________________]");
+	if (tolower(getoption("Ƿ񵼳[Y/n] ")) == 'y') {
+		char path[512];
+		snprintf(path, sizeof(path), "%s.report.csv", sys->db_path);
+		puts(ExportReport(report, sys->database.Strings, path) ? "ѵ" : "ʧܣ");
+	}
+	FreeReport(report);
+}
+
+#define AUDIT_SHOW 10
+
+//! ˻ĿѲڵδ黹
+static bool LoanOrphaned(BorrowRecord *loan, LibraryDB *db) {
+	return FindAccountByID(db, loan->borrower_id) == NULL || FindBookByKey(db, loan->isbn) == NULL;
+}
+
+//! У񣬸ȫδ黹ĵĲ
+void SvrScrub(LibrarySystem sys) {
+	ScrubJob *job = sys->scrub;
+	pthread_mutex_lock(&job->lock);
+	if (job->running) {
+		puts("̨УУԺ鿴");
+	} else if (job->started && !job->readable) {
+		puts("ϴУ飺Уȱʧ𻵣");
+	} else if (job->started) {
+		printf("ϴУ飺%4d-%02d-%02d %02d:%02d:%02d %u %u ʱ%.3f\n",
+			job->tm_finish.year, job->tm_finish.month, job->tm_finish.day,
+			job->tm_finish.hour, job->tm_finish.min, job->tm_finish.sec,
+			job->nblocks, job->nbad, job->seconds);
+		if (job->nbad > 0) {
+			printf("׸𻵿Ϊ%u飬ӱݻָ\n", job->first_bad);
+		}
+	}
+	bool running = job->running;
+	pthread_mutex_unlock(&job->lock);
+	size_t num = 0;
+	BorrowRecord **orphans = (BorrowRecord**)TLParallelScan(sys->database.BorrowRecords, sys->workers,
+		(TLMatchFn*)LoanOrphaned, &sys->database, AUDIT_SHOW, &num);
+	if (num == 0) {
+		puts("ƣδ黹ľжӦ˻Ŀ");
+	} else {
+		printf("ƣ쳣ģʾ%d\n", AUDIT_SHOW);
+		for (size_t i = 0; i < num; ++i) {
+			printf(" ID%u ISBN%llu ʱ䣺%4d-%02d-%02d\n", orphans[i]->borrower_id,
+				(unsigned long long)orphans[i]->isbn, orphans[i]->tm_borrow.year,
+				orphans[i]->tm_borrow.month, orphans[i]->tm_borrow.day);
+		}
+	}
+	free(orphans);
+	if (!running && tolower(getoption("Ƿ̨У飿[Y/n] ")) == 'y') {
+		puts(StartScrub(job) ? "̨У" : "̨УУ");
+	}
+}
+
+typedef struct userrow_s {
+	AccountRecord *account;
+	int loans;
+} UserRow;
+
+static void CountUserLoans(UserRow *row, LibraryDB *db) {
+	row->loans = GetLoanNum(db, row->account->id);
+}
+
+//! ûб񣬸ûͳ
+void SvrUserList(LibrarySystem sys) {
+	LibraryDB *db = &sys->database;
+	size_t num = 0;
+	void **accounts = TLSnapshot(db->AccountRecords, &num);
+	UserRow *rows = (UserRow*)malloc((num ? num : 1) * sizeof(UserRow));
+	for (size_t i = 0; i < num; ++i) {
+		rows[i].account = (AccountRecord*)accounts[i];
+		accounts[i] = &rows[i];
+	}
+	ParallelForEach(db->Workers, accounts, num, (TLVisitFn*)CountUserLoans, db);
+	puts("[^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^]");
+	puts(" ID ˻   ͼ ");
+	for (size_t i = 0; i < num; ++i) {
+		AccountRecord *record = rows[i].account;
+		printf(" %u %s %s %.2fԪ %d\n",
+			record->id, record->account, record->password,
+			record->amount * 0.01f, rows[i].loans);
+	}
+	puts("[______________________________]");
+	free(rows);
+	free(accounts);
+}
+
+//! Ŀ
+void SvrBookList(LibrarySystem sys) {
+	TListNode *p = sys->database.BookRecords->head;
+	puts("[^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^]");
+	puts(" ISBN    ʱ");
+	while (p != NULL) {
+		BookRecord *record = (BookRecord*)p->data;
+		printf(" %s %s %s %d %4d-%02d-%02d\n",
+			record->ISBN, BookName(&sys->database, record), BookAuthor(&sys->database, record), record->stock,
+			record->tm_introduce.year, record->tm_introduce.month, record->tm_introduce.day);
+		p = p->next;
+	}
+	puts("[______________________________]");
+}
+
+//! ļ¼ͼ
+void SvrBorrowRecords(LibrarySystem sys) {
+	clear();
+	puts("[^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^]");
+	puts(" ISBN      黹 ");
+	ArchiveCursor *cursor = OpenArchiveCursor(sys->database.BorrowHistory);
+	TListNode *p = sys->database.BorrowRecords->head;
+	BorrowRecord history;
+	while (true) {
+		BorrowRecord *record = &history;
+		if (!ArchiveNext(cursor, record)) {
+			if (p == NULL) break;
+			record = (BorrowRecord*)p->data;
+			p = p->next;
+		}
+		AccountRecord *borrower = FindAccountByID(&sys->database, record->borrower_id);
+		BookRecord *book = FindBookByKey(&sys->database, record->isbn);
+		char ISBN[24];
+		FormatISBN(record->isbn, ISBN, sizeof(ISBN));
+		printf(" %s %s %s %s %d %4d-%02d-%02d ",
+			book ? book->ISBN : ISBN, book ? BookName(&sys->database, book) : "",
+			book ? BookAuthor(&sys->database, book) : "",
+			borrower ? borrower->account : "-", record->loan_time,
+			record->tm_borrow.year, record->tm_borrow.month, record->tm_borrow.day);
+		if (record->tm_return.year == -1) {
+			printf("");
+		} else {
+			printf("%4d-%02d-%02d", record->tm_return.year,
+				record->tm_return.month, record->tm_return.day);
+		}
+		putchar('\n');
+	}
+	CloseArchiveCursor(cursor);
+	puts("[______________________________]");
+}
+
+//! ʷѯʱʵؽָʱ̵ݣֻʽвѯ
+void SvrHistory(LibrarySystem sys) {
+	History *history = sys->database.History;
+	if (history == NULL) {
+		puts("ǰʵ֧ʷѯ");
+		return;
+	}
+	char when[64];
+	Timestamp tm;
+	getline("ѯʱ̣YYYY-MM-DD HH:MM:SS", when);
+	if (!ParseTimestamp(when, &tm)) {
+		puts("ʱʽ");
+		return;
+	}
+	LibSysDescription scratch = *sys;
+	char path[512];
+	snprintf(path, sizeof(path), "%s.asof", sys->db_path);
+	scratch.db_path = path;
+	scratch.readonly = true;
+	scratch.trace = NULL;
+	scratch.hub = NULL;
+	scratch.replica = NULL;
+	int64_t start = GetMicroseconds();
+	pthread_mutex_lock(&sys->database.lock);
+	int replayed = OpenLibraryDBAsOf(&scratch.database, history, PackTimestamp(&tm), path, sys->workers);
+	pthread_mutex_unlock(&sys->database.lock);
+	if (replayed < 0) {
+		puts("ʱ̳ɻָΧ");
+		return;
+	}
+	printf("ؽ%4d-%02d-%02d %02d:%02d:%02dʱݣط%dʱ%.1f\n",
+		tm.year, tm.month, tm.day, tm.hour, tm.min, tm.sec, replayed, (GetMicroseconds() - start) / 1000.0);
+	while (SvrKeepAlive(&scratch)) {
+		char opt = getoption(
+"====ʷѯ====" "\n"
+"[1] ûб" "\n"
+"[2] 鼮б" "\n"
+"[3] ļ¼" "\n"
+"[4] ͳƱ" "\n"
+"[5] " "\n"
+"============" "\n"
+"$ ");
+		clear();
+		if (opt == '1') {
+			SvrUserList(&scratch);
+		} else if (opt == '2') {
+			SvrBookList(&scratch);
+		} else if (opt == '3') {
+			SvrBorrowRecords(&scratch);
+		} else if (opt == '4') {
+			SvrReport(&scratch);
+		} else if (opt == '5') {
+			break;
+		} else {
+			puts("δ֪ѡ");
+		}
 	}
-	puts(amount > 0 ? "ֵɹ" : "Чֵ");
+	sys->current = scratch.current;
+	sys->session = scratch.session != NULL ? &sys->current : NULL;
+	sys->token = scratch.token;
+	CloseLibraryDBAsOf(&scratch.database, path);
 }
 
 //! ˻
@@ -594,105 +6990,83 @@ void SvrAccountManage(LibrarySystem sys) {
 		puts("˻δǰûţ");
 		return;
 	}
-	while (sys->session != NULL) {
+	while (SvrKeepAlive(sys)) {
 		char opt = getoption(
 "========" "\n"
 "[1] ûб" "\n"
 "[2] û" "\n"
 "[3] " "\n"
 "[4] עû" "\n"
-"[5] " "\n"
+"[5] ͳƱ" "\n"
+"[6] У" "\n"
+"[7] ʷѯ" "\n"
+"[8] " "\n"
 "============" "\n"
 "$ ");
 		clear();
+		if (sys->session == NULL) return;
 		switch (opt) {
 			case '1': {
-				TListNode *p = sys->database.AccountRecords->head;
-				puts("[^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^]");
-				puts(" ID ˻   ͼ ");
-				while (p != NULL) {
-					AccountRecord *backup = sys->session->host_ref;
-					AccountRecord *record = (AccountRecord*)p->data;
-					sys->session->host_ref = record;
-					printf(" %d %s %s %.2fԪ %d\n",
-						record->id, record->account, record->password,
-						record->amount * 0.01f, GetBorrowNum(sys));
-					sys->session->host_ref = backup;
-					p = p->next;
-				}
-				puts("[______________________________]");
+				SvrUserList(sys);
 			}
 			break;
 			case '2': {
-				char account[16];
+				char account[64];
 				getline("û", account);
-				AccountRecord record = { };
-				strcpy(record.account, account);
-				record.hashkey = hash(account);
-				AccountRecord *user = TLMatch(sys->database.AccountRecords, (void*)AccountHashMatch, &record, false);
+				AccountRecord *user = FindAccount(&sys->database, account);
 				if (user == NULL) {
 					puts("ڣ");
 				} else {
-					printf("˻ID%d\n", user->id);
+					printf("˻ID%u\n", user->id);
 				}
 			}
 			break;
 			case '3': {
 				char sid[16];
 				getline("ûID", sid);
-				uint32_t id = atoi(sid);
-				TListNode *p = sys->database.AccountRecords->head;
-				AccountRecord *target = NULL;
-				while (p != NULL) {
-					target = (AccountRecord*)p->data;
-					if (target->id == id) {
-						break;
-					}
-					target = NULL;
-					p = p->next;
-				}
+				uint32_t id = strtoul(sid, NULL, 10);
+				AccountRecord *target = FindAccountByID(&sys->database, id);
 				if (target == NULL) {
 					puts("˻ڣ");
 				} else if (target->id == 1) {
 					puts("޷ùԱ˻룡");
 				} else {
-					strcpy(target->password, "123456");
-					printf("IDΪ%dûΪ\"123456\"\n", target->id);
+					Mutation m = { OpResetPassword, target->id };
+					strcpy(m.text[0], "123456");
+					if (SvrCommit(sys, &m)) {
+						printf("IDΪ%uûΪ\"%s\"\n", target->id, m.text[0]);
+					}
 				}
 			}
 			break;
 			case '4': {
 				char sid[16];
 				getline("ûID", sid);
-				uint32_t id = atoi(sid);
-				TListNode *p = sys->database.AccountRecords->head;
-				AccountRecord *target = NULL;
-				while (p != NULL) {
-					target = (AccountRecord*)p->data;
-					if (target->id == id) {
-						break;
-					}
-					target = NULL;
-					p = p->next;
-				}
+				if (sys->session == NULL) return;
+				uint32_t id = strtoul(sid, NULL, 10);
+				AccountRecord *target = FindAccountByID(&sys->database, id);
 				if (target == NULL) {
 					puts("˻ڣ");
 				} else if (target == sys->session->host_ref) {
 					puts("޷ɾǰ˻");
 				} else {
-					SessionID backup = (SessionID)calloc(1, sizeof(Session));
-					memcpy(backup, sys->session, sizeof(Session));
-					sys->session->host_ref = target;
-					SvrCancelAccount(sys);
-					if (sys->session == NULL) {
-						sys->session = backup;
-					} else {
-						free(backup);
-					}
+					SvrCancelTarget(sys, target);
 				}
 			}
 			break;
 			case '5': {
+				SvrReport(sys);
+			}
+			break;
+			case '6': {
+				SvrScrub(sys);
+			}
+			break;
+			case '7': {
+				SvrHistory(sys);
+			}
+			break;
+			case '8': {
 				return;
 			}
 			break;
@@ -705,7 +7079,7 @@ void SvrAccountManage(LibrarySystem sys) {
 
 //! ûͼ
 void SvrAccountView(LibrarySystem sys) {
-	while (sys->session != NULL) {
+	while (SvrKeepAlive(sys)) {
 		char opt = getoption(
 "====˻====" "\n"
 "[1] л˺" "\n"
@@ -717,6 +7091,7 @@ void SvrAccountView(LibrarySystem sys) {
 "============" "\n"
 "$ ");
 		clear();
+		if (sys->session == NULL) return;
 		switch (opt) {
 			case '1': {
 				SvrLogin(sys);
@@ -751,30 +7126,40 @@ void SvrAccountView(LibrarySystem sys) {
 	}
 }
 
-//! Ŀ
-void SvrBookList(LibrarySystem sys) {
-	TListNode *p = sys->database.BookRecords->head;
-	puts("[^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^]");
-	puts(" ISBN    ʱ");
-	while (p != NULL) {
-		BookRecord *record = (BookRecord*)p->data;
-		printf(" %s %s %s %d %4d-%02d-%02d\n",
-			record->ISBN, record->name, record->author, record->stock,
-			record->tm_introduce.year, record->tm_introduce.month, record->tm_introduce.day);
-		p = p->next;
+//! ¼
+BookRecord** SvrSearch(LibrarySystem sys, int field, const char *pattern, size_t *num, bool *owned) {
+	int64_t start = GetMicroseconds();
+	BookRecord **results = SearchBooks(&sys->database, field, pattern, num, owned);
+	TraceEvent event = { TraceSearch, 0, 0, 0, 0, 0, field };
+	strcpy(event.text[0], pattern);
+	SvrTrace(sys, &event, start);
+	return results;
+}
+
+//! ʾǰ׺ȫĽΨһѡʱʾȫĿѡʱһг
+void SvrPrintCandidates(LibrarySystem sys, BookRecord **candidates, size_t num) {
+	LibraryDB *db = &sys->database;
+	if (num == 1) {
+		printf("ѲȫΪ%s %s ߣ%s\n",
+			candidates[0]->ISBN, BookName(db, candidates[0]), BookAuthor(db, candidates[0]));
+	} else if (num > 1) {
+		puts("ƥISBN");
+		for (size_t i = 0; i < num; ++i) {
+			printf(" %s %s\n", candidates[i]->ISBN, BookName(db, candidates[i]));
+		}
 	}
-	puts("[______________________________]");
 }
 
 //! Ŀѯ
 void SvrSearchBook(LibrarySystem sys) {
-	while (sys->session != NULL) {
+	while (SvrKeepAlive(sys)) {
 		char opt = getoption(
 "========" "\n"
 "[1] ISBN" "\n"
 "[2] ģ" "\n"
 "[3] ߣģ" "\n"
-"[4] " "\n"
+"[4] ǰ׺ȫ" "\n"
+"[5] " "\n"
 "============" "\n"
 "$ ");
 		clear();
@@ -782,28 +7167,36 @@ void SvrSearchBook(LibrarySystem sys) {
 			case '1': {
 				char ISBN[64];
 				getline("ISBNţ", ISBN);
-				BookRecord *record = TLMatch(sys->database.BookRecords, (void*)ISBNMatch, ISBN, false);
+				size_t num = 0;
+				bool owned = false;
+				BookRecord **results = SvrSearch(sys, SearchISBN, ISBN, &num, &owned);
+				BookRecord *candidates[COMPLETE_MAX];
+				size_t ncandidates = 0;
+				BookRecord *record = num > 0 ? results[0] : ResolveBook(&sys->database, ISBN, candidates, &ncandidates);
+				SvrPrintCandidates(sys, candidates, ncandidates);
 				if (record == NULL) {
 					puts("鼮ڣ");
 				} else {
 					printf("%s ߣ%s %d\n",
-						record->name, record->author, record->stock);
+						BookName(&sys->database, record), BookAuthor(&sys->database, record), record->stock);
 				}
+				if (owned) free(results);
 			}
 			break;
 			case '2': {
 				char partial_name[64];
 				getline("", partial_name);
 				puts("[^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^]");
-				TListNode *p = sys->database.BookRecords->head;
-				while (p != NULL) {
-					BookRecord *record = (BookRecord*)p->data;
-					if (strstr(record->name, partial_name) != NULL) {
-						printf(" ISBN%s %s ߣ%s %d\n",
-							record->ISBN, record->name, record->author, record->stock);
-					}
-					p = p->next;
+				size_t num = 0;
+				bool owned = false;
+				BookRecord **results = SvrSearch(sys, SearchName, partial_name, &num, &owned);
+				for (size_t i = 0; i < num; ++i) {
+					BookRecord *record = results[i];
+					printf(" ISBN%s %s ߣ%s %d\n",
+						record->ISBN, BookName(&sys->database, record),
+						BookAuthor(&sys->database, record), record->stock);
 				}
+				if (owned) free(results);
 				puts("[______________________________]");
 			}
 			break;
@@ -811,19 +7204,38 @@ void SvrSearchBook(LibrarySystem sys) {
 				char partial_name[64];
 				getline("ߣ", partial_name);
 				puts("[^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^]");
-				TListNode *p = sys->database.BookRecords->head;
-				while (p != NULL) {
-					BookRecord *record = (BookRecord*)p->data;
-					if (strstr(record->author, partial_name) != NULL) {
-						printf(" ISBN%s %s ߣ%s %d\n",
-							record->ISBN, record->name, record->author, record->stock);
-					}
-					p = p->next;
+				size_t num = 0;
+				bool owned = false;
+				BookRecord **results = SvrSearch(sys, SearchAuthor, partial_name, &num, &owned);
+				for (size_t i = 0; i < num; ++i) {
+					BookRecord *record = results[i];
+					printf(" ISBN%s %s ߣ%s %d\n",
+						record->ISBN, BookName(&sys->database, record),
+						BookAuthor(&sys->database, record), record->stock);
 				}
+				if (owned) free(results);
 				puts("[______________________________]");
 			}
 			break;
 			case '4': {
+				char prefix[64];
+				getline("ISBNǰ׺", prefix);
+				BookRecord *results[COMPLETE_MAX];
+				int64_t start = GetMicroseconds();
+				size_t num = CompleteBooks(&sys->database, prefix, results, COMPLETE_MAX);
+				TraceEvent event = { TraceSearch, 0, 0, 0, 0, 0, SearchPrefix };
+				strcpy(event.text[0], prefix);
+				SvrTrace(sys, &event, start);
+				puts("[^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^]");
+				for (size_t i = 0; i < num; ++i) {
+					printf(" ISBN%s %s ߣ%s %d\n",
+						results[i]->ISBN, BookName(&sys->database, results[i]),
+						BookAuthor(&sys->database, results[i]), results[i]->stock);
+				}
+				puts("[______________________________]");
+			}
+			break;
+			case '5': {
 				return;
 			}
 			break;
@@ -834,6 +7246,19 @@ void SvrSearchBook(LibrarySystem sys) {
 	}
 }
 
+//! ͬƼ
+void SvrRecommend(LibrarySystem sys, BookRecord *book) {
+	BookRecord *related[CB_TOP_N];
+	uint32_t weights[CB_TOP_N];
+	int num = CBLookup(sys->database.CoBorrow, book, ISBNHash(book->isbn), (void**)related, weights);
+	if (num == 0) return;
+	puts("ĴĶ߻ˣ");
+	for (int i = 0; i < num && i < 5; ++i) {
+		printf(" %s %s %s\n", related[i]->ISBN,
+			BookName(&sys->database, related[i]), BookAuthor(&sys->database, related[i]));
+	}
+}
+
 //! Ŀķ
 void SvrBorrow(LibrarySystem sys) {
 	if (!CheckAccess(sys->session->host_ref->group, Borrow)) {
@@ -843,29 +7268,45 @@ void SvrBorrow(LibrarySystem sys) {
 		puts("鼮ķǰûرգͻѺԣ");
 		return;
 	}
-	while (sys->session != NULL) {
+	while (SvrKeepAlive(sys)) {
 		char ISBN[64], sday[64];
 		int loan_time = 0;
 		getline("ISBNţ", ISBN);
 		getline("", sday);
-		BookRecord *book = TLMatch(sys->database.BookRecords, (void*)ISBNMatch, ISBN, false);
-		if (book == NULL) {
+		if (sys->session == NULL) return;
+		BookRecord *candidates[COMPLETE_MAX];
+		size_t ncandidates = 0;
+		BookRecord *book = ResolveBook(&sys->database, ISBN, candidates, &ncandidates);
+		SvrPrintCandidates(sys, candidates, ncandidates);
+		//! ȫõĿ뾭ȷϷɽ
+		bool confirmed = ncandidates != 1 || tolower(getoption("Ƿĸ飿[Y/n] ")) == 'y';
+		if (sys->session == NULL) return;
+		uint32_t patron_id = sys->session->host_ref->id;
+		TListNode *hold = book != NULL ? FindReadyHold(&sys->database, patron_id, book->isbn) : NULL;
+		if (!confirmed) {
+			puts("ȡġ");
+		} else if (book == NULL) {
 			puts("鼮ڣ");
-		} else if (book->stock == 0) {
+		} else if (book->stock == 0 && hold == NULL) {
 			puts("鼮޴");
+			if (tolower(getoption("ǷԤԼ飿[Y/n] ")) == 'y') {
+				Mutation m = { OpReserve, patron_id, book->isbn };
+				if (SvrCommit(sys, &m)) {
+					printf("ԤԼɹǰڵ%dλ鼮ݺ֪ͨ\n", (int)m.result);
+				} else {
+					puts("ԤԼ飡");
+				}
+			}
 		} else if ((loan_time = atoi(sday)) <= 0) {
 			puts("ЧĽ");
 		} else {
-			BorrowRecord record = { };
-			strcpy(record.ISBN, book->ISBN);
-			record.loan_time = loan_time;
-			record.borrower_id = sys->session->host_ref->id;
-			GetTimestamp(&record.tm_borrow);
-			record.tm_return.year = -1; // unreturned mark
-			TLAppend(sys->database.BorrowRecords, &record);
-			++sys->database.header.borrow_rec_num;
-			--book->stock;
-			puts("ĳɹ");
+			Mutation m = { OpBorrow, patron_id, book->isbn, loan_time };
+			if (SvrCommit(sys, &m)) {
+				puts("ĳɹ");
+				SvrRecommend(sys, book);
+			} else {
+				puts("鼮޴");
+			}
 		}
 		if (tolower(getoption("Ƿģ[Y/n] ")) != 'y') break;
 	}
@@ -881,7 +7322,7 @@ void SvrNewBook(LibrarySystem sys) {
 		puts("ǰûȨĿ");
 		return;
 	}
-	while (sys->session != NULL) {
+	while (SvrKeepAlive(sys)) {
 		char ISBN[64], name[64], author[64], snumber[64];
 		int number = 0;
 		getline("ISBNţ", ISBN);
@@ -889,25 +7330,33 @@ void SvrNewBook(LibrarySystem sys) {
 		getline("ߣ", author);
 		getline("", snumber);
 
-		BookRecord *book = TLMatch(sys->database.BookRecords, (void*)ISBNMatch, ISBN, false);
-		if (book != NULL && (strcmp(book->name, name) != 0 || strcmp(book->author, author))) {
+		uint64_t isbn = ParseISBN(ISBN);
+		BookRecord *book = FindBookByKey(&sys->database, isbn);
+		StringPool *strings = sys->database.Strings;
+		if (isbn == 0) {
+			puts("ЧISBNţλУλ");
+		} else if (book != NULL && (book->name != SPLookup(strings, name) || book->author != SPLookup(strings, author))) {
 			puts("ĿĿϢͻĿϢ£");
-			printf("[ISBN%s %s ߣ%s\n]\n");
+			printf("[ISBN%s %s ߣ%s]\n",
+				book->ISBN, BookName(&sys->database, book), BookAuthor(&sys->database, book));
 		} else if ((number = atoi(snumber)) <= 0) {
 			puts("ĿĿӦΪһ");
-		} else if (book != NULL) {
-			book->stock += number;
-			puts("鼮ĿѲ䣡");
 		} else {
-			BookRecord record = { };
-			strcpy(record.ISBN, ISBN);
-			strcpy(record.name, name);
-			strcpy(record.author, author);
-			record.stock = number;
-			GetTimestamp(&record.tm_introduce);
-			TLAppend(sys->database.BookRecords, &record);
-			++sys->database.header.book_rec_num;
-			puts("ĿϢӳɹ");
+			Mutation m = { OpAddBook };
+			m.value = number;
+			strcpy(m.text[0], ISBN);
+			strcpy(m.text[1], name);
+			strcpy(m.text[2], author);
+			if (!SvrCommit(sys, &m)) {
+				puts("ĿϢʧܣ");
+			} else if (book != NULL) {
+				puts("鼮ĿѲ䣡");
+				if (m.result > 0) {
+					printf("%dΪԤԼ߱\n", (int)m.result);
+				}
+			} else {
+				puts("ĿϢӳɹ");
+			}
 		}
 
 		if (tolower(getoption("Ƿӣ[Y/n] ")) != 'y') break;
@@ -916,7 +7365,7 @@ void SvrNewBook(LibrarySystem sys) {
 
 //! 鼮ͼ
 void SvrBookView(LibrarySystem sys) {
-	while (sys->session != NULL) {
+	while (SvrKeepAlive(sys)) {
 		char opt = getoption(
 "========" "\n"
 "[1] 鼮б" "\n"
@@ -927,6 +7376,7 @@ void SvrBookView(LibrarySystem sys) {
 "============" "\n"
 "$ ");
 		clear();
+		if (sys->session == NULL) return;
 		switch (opt) {
 			case '1': {
 				SvrBookList(sys);
@@ -958,23 +7408,19 @@ void SvrBookView(LibrarySystem sys) {
 
 //! ˽ļ¼ͼ
 void SvrUserBorrowView(LibrarySystem sys) {
-	while (sys->session != NULL) {
+	while (SvrKeepAlive(sys)) {
 		puts("[^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^]");
 		puts("  ISBN     ");
-		TListNode *p = sys->database.BorrowRecords->head;
+		TListNode *node = NULL;
+		size_t cursor = 0;
 		int index = 0;
-		while (p != NULL) {
-			BorrowRecord *record = (BorrowRecord*)p->data;
-			if (record->borrower_id == sys->session->host_ref->id
-				&& record->tm_return.year == -1) {
-				BookRecord *book = TLMatch(sys->database.BookRecords,
-					(void*)ISBNMatch, record->ISBN, false);
-				printf(" [%d] %s %s %s %4d-%02d-%02d %d\n",
-					++index, book->ISBN, book->name, book->author,
-					record->tm_borrow.year, record->tm_borrow.month, record->tm_borrow.day,
-					record->loan_time);
-			}
-			p = p->next;
+		while ((node = HINext(sys->database.LoanIndex, sys->session->host_ref->id, &cursor)) != NULL) {
+			BorrowRecord *record = (BorrowRecord*)node->data;
+			BookRecord *book = FindBookByKey(&sys->database, record->isbn);
+			printf(" [%d] %s %s %s %4d-%02d-%02d %d\n",
+				++index, book->ISBN, BookName(&sys->database, book), BookAuthor(&sys->database, book),
+				record->tm_borrow.year, record->tm_borrow.month, record->tm_borrow.day,
+				record->loan_time);
 		}
 		puts("[______________________________]");
 		char opt = getoption(
@@ -983,46 +7429,37 @@ void SvrUserBorrowView(LibrarySystem sys) {
 "[2] " "\n"
 "============" "\n"
 "$ ");
+		if (sys->session == NULL) return;
 		switch (opt) {
 			case '1': {
+				if (sys->readonly) {
+					puts("ֻʵ");
+					break;
+				}
 				char sindex[16];
 				getline("黹Ŀ", sindex);
+				if (sys->session == NULL) return;
 				int return_id = atoi(sindex);
-				if (return_id < 0 || return_id > index) {
+				TListNode *target = NULL;
+				size_t cursor = 0;
+				for (int index = 0; index < return_id; ++index) {
+					target = HINext(sys->database.LoanIndex, sys->session->host_ref->id, &cursor);
+					if (target == NULL) break;
+				}
+				if (return_id <= 0 || return_id > index || target == NULL) {
 					puts("Ŀڣԣ");
 				} else {
-					BorrowRecord *target = NULL;
-					TListNode *p = sys->database.BorrowRecords->head;
-					int index = 0;
-					while (p != NULL) {
-						BorrowRecord *record = (BorrowRecord*)p->data;
-						if (record->borrower_id == sys->session->host_ref->id
-							&& record->tm_return.year == -1) {
-							BookRecord *book = TLMatch(sys->database.BookRecords,
-								(void*)ISBNMatch, record->ISBN, false);
-							if (++index == return_id) {
-								target = record;
-								break;
-							}
-						}
-						p = p->next;
-					}
-					AccountRecord *borrower = TLMatch(sys->database.AccountRecords,
-						(void*)AccountIDMatch, &target->borrower_id, false);
-					BookRecord *book = TLMatch(sys->database.BookRecords,
-						(void*)ISBNMatch, target->ISBN, false);
-					GetTimestamp(&target->tm_return);
-					double diff = GetDuration(&target->tm_return, &target->tm_borrow);
-					int days = (int)(diff / 86400);
-					if (days > target->loan_time) {
-						borrower->amount -= (days - target->loan_time) * 0.3 * 100; // 060.3/day
-						printf("λӳ%d죬֧%.2fԪ\n", days - target->loan_time,
-							(days - target->loan_time) * 0.3);
-						if (borrower->amount < 0) {
+					BorrowRecord *record = (BorrowRecord*)target->data;
+					Mutation m = { OpReturn, record->borrower_id, record->isbn };
+					m.tm_ref = record->tm_borrow;
+					SvrCommit(sys, &m);
+					int overdue = m.result;
+					if (overdue > 0) {
+						printf("λӳ%d죬֧%.2fԪ\n", overdue, overdue * 0.3);
+						if (sys->session->host_ref->amount < 0) {
 							puts("㣬뼰ʱֵͻѣ");
 						}
 					}
-					++book->stock;
 					puts("鼮黹ɹ");
 				}
 			}
@@ -1039,43 +7476,72 @@ void SvrUserBorrowView(LibrarySystem sys) {
 	}
 }
 
-//! ļ¼ͼ
-void SvrBorrowRecords(LibrarySystem sys) {
+//! з
+void SvrPopularBooks(LibrarySystem sys) {
+	char opt = getoption(
+"========" "\n"
+"[1] һ" "\n"
+"[2] һ" "\n"
+"[3] ۼ" "\n"
+"============" "\n"
+"$ ");
 	clear();
-	puts("[^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^]");
-	puts(" ISBN      黹 ");
-	TListNode *p = sys->database.BorrowRecords->head;
-	while (p != NULL) {
-		BorrowRecord *record = (BorrowRecord*)p->data;
-		AccountRecord *borrower = TLMatch(sys->database.AccountRecords,
-			(void*)AccountIDMatch, &record->borrower_id, false);
-		BookRecord *book = TLMatch(sys->database.BookRecords,
-			(void*)ISBNMatch, record->ISBN, false);
-		printf(" %s %s %s %s %d %4d-%02d-%02d ",
-			book->ISBN, book->name, book->author, borrower->account, record->loan_time,
-			record->tm_borrow.year, record->tm_borrow.month, record->tm_borrow.day);
-		if (record->tm_return.year == -1) {
-			printf("");
-		} else {
-			printf("%4d-%02d-%02d", record->tm_return.year,
-				record->tm_return.month, record->tm_return.day);
+	const size_t topk = 100;
+	if (opt == '1' || opt == '2') {
+		Timestamp now;
+		GetTimestamp(&now);
+		size_t num = 0;
+		HitCounter *top = HHTopK(sys->database.Popularity, GetDayNumber(&now),
+			opt == '1' ? 7 : 30, topk, &num);
+		puts("[^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^]");
+		puts("  ISBN  Ĵ ");
+		for (size_t i = 0; i < num; ++i) {
+			BookRecord *book = FindBookByKey(&sys->database, top[i].isbn);
+			char ISBN[24];
+			FormatISBN(top[i].isbn, ISBN, sizeof(ISBN));
+			printf(" [%d] %s %s %u\n", (int)i + 1, book ? book->ISBN : ISBN,
+				book ? BookName(&sys->database, book) : "", top[i].count);
 		}
-		putchar('\n');
-		p = p->next;
+		puts("[______________________________]");
+		free(top);
+	} else if (opt == '3') {
+		BookRecord **top = (BookRecord**)calloc(topk + 1, sizeof(BookRecord*));
+		size_t num = 0;
+		for (TListNode *p = sys->database.BookRecords->head; p != NULL; p = p->next) {
+			BookRecord *book = (BookRecord*)p->data;
+			if (book->borrow_count == 0) continue;
+			size_t i = num < topk ? num++ : topk;
+			while (i > 0 && top[i - 1]->borrow_count < book->borrow_count) {
+				top[i] = top[i - 1];
+				--i;
+			}
+			top[i] = book;
+		}
+		puts("[^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^]");
+		puts("  ISBN  Ĵ ");
+		for (size_t i = 0; i < num; ++i) {
+			printf(" [%d] %s %s %u\n", (int)i + 1, top[i]->ISBN,
+				BookName(&sys->database, top[i]), top[i]->borrow_count);
+		}
+		puts("[______________________________]");
+		free(top);
+	} else {
+		puts("δ֪ѡ");
 	}
-	puts("[______________________________]");
 }
 
 //! ͼ
 void SvrBorrowView(LibrarySystem sys) {
-	while (sys->session != NULL) {
+	while (SvrKeepAlive(sys)) {
 		char opt = getoption(
 "========" "\n"
 "[1] ļ¼" "\n"
-"[2] " "\n"
+"[2] " "\n"
+"[3] " "\n"
 "============" "\n"
 "$ ");
 		clear();
+		if (sys->session == NULL) return;
 		switch (opt) {
 			case '1': {
 				if (RequireService(sys->session->host_ref->group, RecordService)) {
@@ -1086,6 +7552,14 @@ void SvrBorrowView(LibrarySystem sys) {
 			}
 			break;
 			case '2': {
+				if (RequireService(sys->session->host_ref->group, RecordService)) {
+					SvrPopularBooks(sys);
+				} else {
+					puts("зδǰûţ");
+				}
+			}
+			break;
+			case '3': {
 				clear();
 				return;
 			}
@@ -1099,7 +7573,7 @@ void SvrBorrowView(LibrarySystem sys) {
 
 //! ˵
 void SvrMenu(LibrarySystem sys) {
-	while (sys->session != NULL) {
+	while (SvrKeepAlive(sys)) {
 		char opt = getoption(
 "========" "\n"
 "[1] ˻" "\n"
@@ -1109,6 +7583,7 @@ void SvrMenu(LibrarySystem sys) {
 "============" "\n"
 "$ ");
 		clear();
+		if (sys->session == NULL) return;
 		switch (opt) {
 			case '1': {
 				SvrAccountView(sys);
@@ -1148,15 +7623,51 @@ void SvrMain(LibrarySystem sys) {
 }
 
 /// ϵͳۺ
+void GetDBPath(BootInfo *info, char *buf, size_t size) {
+	if (info->db_file[0] != '\0') {
+		snprintf(buf, size, "%s", info->db_file);
+	} else {
+		snprintf(buf, size, "%s\\librecords.db", info->root);
+	}
+}
+
 LibrarySystem Boot(BootInfo *info) {
-	char buf[256];
-	snprintf(buf, 256, "%s\\librecords.db", info->root);
+	char buf[512];
+	GetDBPath(info, buf, sizeof(buf));
 	LibrarySystem sys = (LibrarySystem)calloc(1, sizeof(LibSysDescription));
-	if (!OpenLibraryDB(&sys->database, buf)) {
+	sys->workers = MakeThreadPool(GetProcessorNum());
+	sys->sessions = MakeSessionManager(SESSION_IDLE_SECONDS);
+	pthread_mutex_init(&sys->database.lock, NULL);
+	sys->database.IO = MakeIOBackend();
+	if (!OpenLibraryDB(&sys->database, buf, sys->workers)) {
+		IODestroy(sys->database.IO);
+		SMDestroy(sys->sessions);
+		TPDestroy(sys->workers);
 		free(sys);
 		return NULL;
 	}
 	sys->db_path = strdup(buf);
+	sys->database.cancel_hook = (AccountCancelFn*)SMCloseAccount;
+	sys->database.cancel_args = sys->sessions;
+	sys->scrub = MakeScrubJob(buf);
+	if (info->history) {
+		sys->database.History = OpenHistory(buf, sys->database.journal_lsn);
+	}
+	int replayed = ReplayJournal(&sys->database, buf);
+	if (replayed > 0) {
+		printf("Ѵ־ָ%d\n", replayed);
+	}
+	//! ύȴʱɻLIBSYS_COMMIT_WAIT_US
+	const char *wait = getenv("LIBSYS_COMMIT_WAIT_US");
+	if (!info->replica) {
+		sys->database.Log = OpenJournal(buf, wait != NULL ? strtoul(wait, NULL, 10) : JOURNAL_MAX_WAIT_US);
+		if (sys->database.Log == NULL) {
+			puts("־ʧܣα˳ʱ棡");
+		}
+	}
+	if (sys->database.Log != NULL) {
+		sys->database.Checkpoint = StartCheckpointer(&sys->database, buf);
+	}
 
 	time_t tm;
 	time(&tm);
@@ -1165,9 +7676,33 @@ LibrarySystem Boot(BootInfo *info) {
 	return sys;
 }
 
+//! 㣺ſ־͸дպ־ֻɾݸ
 void Shutdown(LibrarySystem *sys) {
-	ExportLibraryDB(&(*sys)->database, (*sys)->db_path);
-	CloseLibraryDB(&(*sys)->database);
+	LibraryDB *db = &(*sys)->database;
+	bool replica = (*sys)->replica != NULL;
+	StopCheckpointer(db->Checkpoint);
+	db->Checkpoint = NULL;
+	CloseTraceRecorder((*sys)->trace);
+	CloseReplicaClient((*sys)->replica);
+	ScrubDestroy((*sys)->scrub);
+	CloseJournal(db->Log);
+	db->Log = NULL;
+	CloseReplicaHub((*sys)->hub);
+	//! ־תΪ־κ󷽿
+	if (!replica && ExportLibraryDB(db, (*sys)->db_path)
+		&& (db->History == NULL || RetainJournal(db->History))) {
+		char buf[512];
+		snprintf(buf, sizeof(buf), "%s.wal", (*sys)->db_path);
+		TruncateFile(buf, 0);
+	}
+	CloseHistory(db->History);
+	db->History = NULL;
+	CloseLibraryDB(db);
+	if (replica) RemoveLibraryDB((*sys)->db_path);
+	IODestroy(db->IO);
+	pthread_mutex_destroy(&db->lock);
+	SMDestroy((*sys)->sessions);
+	TPDestroy((*sys)->workers);
 	free((*sys)->db_path);
 	free(*sys);
 	*sys = NULL;
@@ -1179,15 +7714,229 @@ void Run(LibrarySystem sys) {
 	puts("ֹ");
 }
 
+//! ڸٿյĸϻطţnthreads̷ֵ߳Ự
+int Replay(BootInfo *info, const char *path, int nthreads, bool paced) {
+	size_t nevents = 0;
+	TraceEvent *events = LoadTrace(path, &nevents);
+	if (events == NULL) {
+		puts("ļȡʧܣ");
+		return -1;
+	}
+	char src[512], dst[512];
+	snprintf(src, sizeof(src), "%s.db", path);
+	snprintf(dst, sizeof(dst), "%s.replay", path);
+	if (!CopyLibraryDB(src, dst)) {
+		puts("ٿȱʧ޷طţ");
+		free(events);
+		return -1;
+	}
+	snprintf(src, sizeof(src), "%s.db.wal", path);
+	snprintf(dst, sizeof(dst), "%s.replay.wal", path);
+	remove(dst);
+	DuplicateFile(src, dst);
+	snprintf(info->db_file, sizeof(info->db_file), "%s.replay", path);
+	LibrarySystem sys = Boot(info);
+	if (sys == NULL) {
+		puts("ʧܣ");
+		free(events);
+		return -1;
+	}
+	printf("ط%u%d߳ %s\n", (unsigned)nevents, nthreads, paced ? "ԭʼ" : "ȫ");
+	uint32_t *latency = (uint32_t*)calloc(nevents + 1, sizeof(uint32_t));
+	ReplayWorker *workers = (ReplayWorker*)calloc(nthreads, sizeof(ReplayWorker));
+	pthread_t *threads = (pthread_t*)calloc(nthreads, sizeof(pthread_t));
+	ReplayAccounts accounts = { PTHREAD_MUTEX_INITIALIZER, MakeHashIndex(64) };
+	int64_t begin = GetMicroseconds();
+	for (int i = 0; i < nthreads; ++i) {
+		ReplayWorker worker = { sys, &accounts, MakeHashIndex(64), events, nevents, latency, i, nthreads, paced, begin };
+		workers[i] = worker;
+		pthread_create(&threads[i], NULL, ReplayWorkerMain, &workers[i]);
+	}
+	for (int i = 0; i < nthreads; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+	PrintReplayReport(events, latency, nevents, GetMicroseconds() - begin);
+	for (size_t i = 0; i < accounts.names->capacity; ++i) {
+		void *name = accounts.names->entries[i].ref;
+		if (name != NULL && name != HI_TOMBSTONE) free(name);
+	}
+	HIDestroy(accounts.names);
+	Shutdown(&sys);
+	free(threads);
+	free(workers);
+	free(latency);
+	free(events);
+	return 0;
+}
+
+//! ߽ݿָָʱָ̣ǰΪ<path>.before-restore
+int Restore(BootInfo *info, const char *when) {
+	Timestamp tm;
+	if (!ParseTimestamp(when, &tm)) {
+		puts("ʱʽ");
+		return -1;
+	}
+	char path[512], buf[528], scratch[528], backup[528], staging[528];
+	GetDBPath(info, path, sizeof(path));
+	snprintf(buf, sizeof(buf), "%s.pitr", path);
+	if (access(buf, F_OK) != 0) {
+		puts("δҵɹָʷ");
+		return -1;
+	}
+	snprintf(scratch, sizeof(scratch), "%s.asof", path);
+	snprintf(backup, sizeof(backup), "%s.before-restore", path);
+	snprintf(staging, sizeof(staging), "%s.restoring", path);
+	History *history = OpenHistory(path, 0);
+	ThreadPool *workers = MakeThreadPool(GetProcessorNum());
+	LibraryDB db;
+	int replayed = OpenLibraryDBAsOf(&db, history, PackTimestamp(&tm), scratch, workers);
+	if (replayed < 0) {
+		puts("ʱ̳ɻָΧ");
+		CloseHistory(history);
+		TPDestroy(workers);
+		return -1;
+	}
+	//! ָǰ־ؽдݴ⣬ɹ滻ԭ
+	//! ݴķƬԽԭ⣬滻ԭ嵥õķƬʼ
+	char wal[528], backup_wal[544];
+	snprintf(wal, sizeof(wal), "%s.wal", path);
+	snprintf(backup_wal, sizeof(backup_wal), "%s.wal", backup);
+	uint64_t generations[DB_MAX_SHARDS] = { };
+	uint32_t nshards = ReadShardGenerations(path, generations);
+	for (uint32_t k = 0; k < db.nshards && k < nshards; ++k) {
+		if (db.ShardGenerations[k] <= generations[k]) db.ShardGenerations[k] = generations[k] + 1;
+	}
+	RemoveLibraryDB(backup);
+	RemoveLibraryDB(staging);
+	bool exported = CopyLibraryDB(path, backup) && (access(wal, F_OK) != 0 || DuplicateFile(wal, backup_wal))
+		&& RetainJournal(history) && ExportLibraryDB(&db, staging);
+	if (!exported) RemoveLibraryDB(staging);
+	bool succeed = exported && ReplaceLibraryDB(staging, path);
+	if (succeed) {
+		TrimHistory(history, db.journal_lsn);
+		printf("ѻָ%sط%dǰ־%uԭΪ%s\n",
+			when, replayed, (unsigned)db.journal_lsn, backup);
+	} else if (exported) {
+		printf("滻ԭʧܣ%sָ\n", backup);
+	} else {
+		puts("ָʧܣԭδĶ");
+	}
+	CloseLibraryDBAsOf(&db, scratch);
+	CloseHistory(history);
+	TPDestroy(workers);
+	return succeed ? 0 : -1;
+}
+
+//! ˽и𲽣־ṩֻ
+int RunReplica(BootInfo *info, const char *address) {
+	char primary[sizeof(info->db_file) - 32];
+	int fd = ConnectPrimary(address, primary, sizeof(primary));
+	if (fd < 0) {
+		puts("޷⣡");
+		return -1;
+	}
+	snprintf(info->db_file, sizeof(info->db_file), "%s.replica.%d", primary, (int)getpid());
+	//! ĺ̨ڸ;лվɴƬʧʱ
+	bool copied = false;
+	for (int i = 0; i < 3 && !copied; ++i) {
+		copied = CopyLibraryDB(primary, info->db_file);
+	}
+	if (!copied) {
+		puts("㸴ʧܣ");
+		close(fd);
+		return -1;
+	}
+	info->replica = true;
+	LibrarySystem sys = Boot(info);
+	if (sys == NULL) {
+		puts("ʧܣ");
+		RemoveLibraryDB(info->db_file);
+		close(fd);
+		return -1;
+	}
+	LibraryDB *db = &sys->database;
+	if ((sys->replica = StartReplicaClient(fd, db)) == NULL) {
+		puts("־ʧܣ");
+		close(fd);
+		Shutdown(&sys);
+		RemoveLibraryDB(info->db_file);
+		return -1;
+	}
+	sys->readonly = true;
+	puts("ֻѾ");
+	InputYieldInfo yield = { &db->lock, (void(*)(void*))SvrKeepAlive, sys };
+	pthread_mutex_lock(&db->lock);
+	InputYield = &yield;
+	Run(sys);
+	InputYield = NULL;
+	pthread_mutex_unlock(&db->lock);
+	Shutdown(&sys);
+	return 0;
+}
+
+void Usage(const char *name) {
+	printf("÷%s [--record <ļ>] [--replicate <˿|׽·>]\n", name);
+	printf("      %s --replay <ļ> [--threads <߳>] [--paced]\n", name);
+	printf("      %s --replica <˿|׽·>\n", name);
+	printf("      %s --restore \"YYYY-MM-DD HH:MM:SS\"\n", name);
+}
+
 int main(int argc, char const *argv[])
 {
-	BootInfo info;
+	BootInfo info = { };
 	getcwd(info.root, 256);
+	const char *record = NULL, *replay = NULL, *replicate = NULL, *primary = NULL, *restore = NULL;
+	int nthreads = 1;
+	bool paced = false;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+			record = argv[++i];
+		} else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+			replay = argv[++i];
+		} else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+			nthreads = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--paced") == 0) {
+			paced = true;
+		} else if (strcmp(argv[i], "--replicate") == 0 && i + 1 < argc) {
+			replicate = argv[++i];
+		} else if (strcmp(argv[i], "--replica") == 0 && i + 1 < argc) {
+			primary = argv[++i];
+		} else if (strcmp(argv[i], "--restore") == 0 && i + 1 < argc) {
+			restore = argv[++i];
+		} else {
+			Usage(argv[0]);
+			return -1;
+		}
+	}
+	if (replay != NULL) {
+		return Replay(&info, replay, nthreads, paced);
+	}
+	if (primary != NULL) {
+		return RunReplica(&info, primary);
+	}
+	if (restore != NULL) {
+		return Restore(&info, restore);
+	}
+	info.history = true;
 	LibrarySystem sys = Boot(&info);
 	if (sys == NULL) {
 		puts("ʧܣ");
 		return -1;
 	}
+	if (record != NULL && (sys->trace = OpenTraceRecorder(record, &sys->database)) == NULL) {
+		puts("ļʧܣ");
+	}
+	if (replicate != NULL && sys->database.Log != NULL) {
+		Journal *log = sys->database.Log;
+		if ((sys->hub = OpenReplicaHub(replicate, sys->db_path, sys->database.journal_lsn)) != NULL) {
+			pthread_mutex_lock(&log->lock);
+			log->ship = (JournalShipFn*)HubPublish;
+			log->ship_args = sys->hub;
+			pthread_mutex_unlock(&log->lock);
+		} else {
+			puts("ƶ˿ڼʧܣ");
+		}
+	}
 	Run(sys);
 	Shutdown(&sys);
 	return 0;